@@ -1,72 +1,223 @@
 #include "audioDSP.h"
 
+void AudioView::copyTo(sample* output) const
+{
+    memcpy(output, first, firstLength*sizeof(sample));
+    memcpy(output+firstLength, second, secondLength*sizeof(sample));
+}
+
 AudioQueue::AudioQueue(int QueueLength)                                     /// Constructor. Takes maximum length.
 {
-    len = QueueLength;
+    len = 1;
+    while(len < QueueLength)                                                /// Power of 2, so that positions can be masked
+        len *= 2;
+    mask = len-1;
     audio = new sample[len];                                                /// Initializing audio data array.
-    inpos = 0;                                                              /// Front and back both set to zero. Setting them 1 sample apart doesn't really make sense
-    outpos = 0;                                                             /// because several samples will be pushed or popped at once.
+    pushed = 0;
+    waiters = 0;
 }
 AudioQueue::~AudioQueue()
 {
     delete[] audio;
 }
-bool AudioQueue::data_available(int n_samples)                              /// Check if the queue has n_samples of data in it.
-{
-    if(inpos>=outpos)
-        return (inpos-outpos)>=n_samples;
-    else
-        return (inpos+len-outpos)>=n_samples;
-}
-bool AudioQueue::space_available(int n_samples)                             /// Check if the queue has space for n_samples of new data.
+bool AudioQueue::resize(int QueueLength)                                    /// Readers' positions are all 0 until the first push()
 {
-    if(inpos>=outpos)
-        return (outpos+len-inpos)>n_samples;
-    else
-        return (outpos-inpos)>n_samples;
+    if(pushed.load(std::memory_order_acquire) != 0)
+        return false;
+    int newLen = 1;
+    while(newLen < QueueLength)
+        newLen *= 2;
+    if(newLen != len)
+    {
+        delete[] audio;
+        len = newLen;
+        mask = len-1;
+        audio = new sample[len];
+    }
+    return true;
 }
-void AudioQueue::push(sample* input, int n_samples, float volume)           /// Push n_samples of new data to the queue
+
+/// Positions wrap around audio[] at most once per copy, so a copy is one or two memcpy()s,
+/// or gain kernel calls when the volume isn't 1.
+void AudioQueue::copyOut(sample* output, unsigned long long position, int n_samples, float volume) const
 {
-    if(!space_available(n_samples))
+    int start = position&mask;
+    int first = std::min(n_samples, len-start);                             /// Up to the end of audio[], then wrap around
+    if(volume == 1)
     {
-        std::cout<<"\n\nAudio queue overflow\n\n";
+        memcpy(output, audio+start, first*sizeof(sample));
+        memcpy(output+first, audio, (n_samples-first)*sizeof(sample));
         return;
     }
-    for(int i=0; i<n_samples; i++)
-        audio[(inpos+i)%len] = input[i]*volume;
-    inpos=(inpos+n_samples)%len;
+    const DSPKernels& kernels = dspKernels();
+    kernels.gain(output, audio+start, first, volume);
+    kernels.gain(output+first, audio, n_samples-first, volume);
 }
-void AudioQueue::pop(sample* output, int n_samples, float volume)           /// Pop n_samples of data from the queue
+
+void AudioQueue::push(sample* input, int n_samples, float volume)           /// Push n_samples of new data to the queue
 {
-    if(!data_available(n_samples))
+    unsigned long long back = pushed.load(std::memory_order_relaxed);      /// Only this thread moves the back
+    int start = back&mask;
+    int first = std::min(n_samples, len-start);
+    if(volume == 1)
     {
-        std::cout<<"\n\nAudio queue underflow\n\n";
-        return;
+        memcpy(audio+start, input, first*sizeof(sample));
+        memcpy(audio, input+first, (n_samples-first)*sizeof(sample));
+    }
+    else
+    {
+        const DSPKernels& kernels = dspKernels();
+        kernels.gain(audio+start, input, first, volume);
+        kernels.gain(audio, input+first, n_samples-first, volume);
     }
-    for(int i=0; i<n_samples; i++)
-        output[i] = audio[(outpos+i)%len]*volume;
-    outpos=(outpos+n_samples)%len;
+    pushed.store(back+n_samples, std::memory_order_release);                /// Publishes the samples to readers and peeks
+    std::atomic_thread_fence(std::memory_order_seq_cst);                    /// Either a waiter sees the samples or this sees the waiter
+    if(waiters.load(std::memory_order_relaxed) > 0)
+        newAudio.notify_all();
+}
+bool AudioQueue::waitFor(unsigned long long position, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(waitLock);
+    waiters.fetch_add(1);
+    bool arrived = newAudio.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                     [&]{ return pushed.load() >= position; });
+    waiters.fetch_sub(1);
+    return arrived;
+}
+bool AudioQueue::peekFreshData(sample* output, int n_samples,               /// Peek the freshest n_samples (for instantly reactive FFT)
+                               float volume)
+{
+    unsigned long long back = pushed.load(std::memory_order_acquire);
+    if(back < (unsigned long long)n_samples || !peekAt(output, back-n_samples, n_samples))
+        return false;
+    if(volume != 1)
+        dspKernels().gain(output, output, n_samples, volume);
+    return true;
+}
+
+/// The sample at position is stored at audio[position&mask] until it is overwritten,
+/// len samples later. A quarter of the queue is kept as margin for pushes that are in
+/// progress while copying.
+bool AudioQueue::stillThere(unsigned long long position) const
+{
+    return pushed.load(std::memory_order_acquire)-position <= (unsigned long long)(len - len/4);
+}
+bool AudioQueue::peekAt(sample* output, unsigned long long position,       /// Copy n_samples starting at position
+                        int n_samples)
+{
+    if(position+n_samples > pushed.load(std::memory_order_acquire) || !stillThere(position))
+        return false;
+    copyOut(output, position, n_samples, 1);
+    std::atomic_thread_fence(std::memory_order_acquire);                    /// The copy happens before the check below
+    return stillThere(position);                                            /// Still not overwritten after copying
+}
+bool AudioQueue::view(AudioView& output, unsigned long long position,      /// n_samples starting at position, in place
+                      int n_samples) const
+{
+    if(position+n_samples > pushed.load(std::memory_order_acquire) || !stillThere(position))
+        return false;
+    int start = position&mask;
+    output.first = audio+start;
+    output.firstLength = std::min(n_samples, len-start);
+    output.second = audio;
+    output.secondLength = n_samples-output.firstLength;
+    return true;
+}
+bool AudioQueue::freshView(AudioView& output, int n_samples) const         /// The freshest n_samples, in place
+{
+    unsigned long long back = pushed.load(std::memory_order_acquire);
+    return back >= (unsigned long long)n_samples && view(output, back-n_samples, n_samples);
+}
+
+std::vector<const AudioReader*> AudioQueue::readers() const
+{
+    std::lock_guard<std::mutex> lock(readerLock);
+    return std::vector<const AudioReader*>(readerList.begin(), readerList.end());
+}
+
+/**
+-------------------------
+----class AudioReader----
+-------------------------
+**/
+AudioReader::AudioReader(AudioQueue& queue, const char* name, bool fromStart) : queue(queue)
+{
+    readerName = name;
+    unsigned long long back = queue.samplesPushed();
+    unsigned long long oldest = back > (unsigned long long)queue.len/2 ? back-queue.len/2 : 0;
+    position = fromStart ? oldest : back;
+    samplesRead = overruns = underruns = maxLag = 0;
+    std::lock_guard<std::mutex> lock(queue.readerLock);
+    queue.readerList.push_back(this);
+}
+AudioReader::~AudioReader()
+{
+    std::lock_guard<std::mutex> lock(queue.readerLock);
+    queue.readerList.erase(std::find(queue.readerList.begin(), queue.readerList.end(), this));
 }
-void AudioQueue::peek(sample* output, int n_samples, float volume)          /// Peek the n_samples that would be popped
+
+unsigned long long AudioReader::catchUp()
 {
-    if(!data_available(n_samples))
+    unsigned long long front = position.load(std::memory_order_relaxed);   /// Only the reading thread moves it
+    if(!queue.stillThere(front))
     {
-        std::cout<<"\n\nAudio queue underflow\n\n";
-        return;
+        unsigned long long resume = queue.samplesPushed()-queue.len/2;
+        overruns.fetch_add(resume-front, std::memory_order_relaxed);
+        front = resume;
+        position.store(front, std::memory_order_release);
     }
-    for(int i=0; i<n_samples; i++)
-        output[i] = audio[(outpos+i)%len]*volume;
+    unsigned long long lagNow = queue.samplesPushed()-front;
+    if(lagNow > maxLag.load(std::memory_order_relaxed))
+        maxLag.store(lagNow, std::memory_order_relaxed);
+    return front;
 }
-void AudioQueue::peekFreshData(sample* output, int n_samples,               /// Peek the freshest n_samples (for instantly reactive FFT)
-                               float volume)
+
+void AudioReader::read(sample* output, int n_samples, float volume)
 {
-    if(!data_available(n_samples))
+    unsigned long long front = catchUp();
+    unsigned long long back = queue.samplesPushed();
+    int available = (int)std::min(back-front, (unsigned long long)n_samples);
+    queue.copyOut(output, front, available, volume);
+    std::atomic_thread_fence(std::memory_order_acquire);                    /// The copy happens before the check below
+    if(!queue.stillThere(front))                                            /// Overwritten while copying: lose them
     {
-        std::cout<<"\n\nAudio queue underflow\n\n";
+        memset(output, 0, n_samples*sizeof(sample));
+        overruns.fetch_add(available, std::memory_order_relaxed);
+        underruns.fetch_add(n_samples, std::memory_order_relaxed);
+        position.store(front+available, std::memory_order_release);
         return;
     }
-    for(int i=0; i<n_samples; i++)
-        output[n_samples-i] = audio[(len+inpos-i)%len]*volume;
+    if(available < n_samples)                                               /// Silence for the rest
+    {
+        memset(output+available, 0, (n_samples-available)*sizeof(sample));
+        underruns.fetch_add(n_samples-available, std::memory_order_relaxed);
+    }
+    samplesRead.fetch_add(available, std::memory_order_relaxed);
+    position.store(front+available, std::memory_order_release);
+}
+
+bool AudioReader::view(AudioView& output, int n_samples)
+{
+    unsigned long long front = catchUp();
+    int available = (int)std::min(queue.samplesPushed()-front, (unsigned long long)n_samples);
+    return available > 0 && queue.view(output, front, available);
+}
+
+bool AudioReader::advance(int n_samples)
+{
+    unsigned long long front = position.load(std::memory_order_relaxed);
+    bool intact = queue.stillThere(front);
+    if(intact)
+        samplesRead.fetch_add(n_samples, std::memory_order_relaxed);
+    else
+        overruns.fetch_add(n_samples, std::memory_order_relaxed);
+    position.store(front+n_samples, std::memory_order_release);
+    return intact;
+}
+
+unsigned long long AudioReader::lag() const
+{
+    return queue.samplesPushed()-position.load(std::memory_order_acquire);
 }
 
 void dftmag(sample* output, sample* input, int n)                           /// O(n^2) DFT. Not actually used.
@@ -107,62 +258,1642 @@ void dftmag(sample* output, sample* input, int n)                           ///
     delete[] outputcos;
 }
 
-void fft(cmplx* output, cmplx* input, int n)                                /// Simplest FFT algorithm
+static bool isPowerOf2(int n)
+{
+    return n>0 && (n&(n-1))==0;
+}
+
+/**
+------------------------
+----class WorkerPool----
+------------------------
+Workers sleep on a condition variable until parallelFor() publishes a job, then grab
+chunks of the index range from a shared atomic counter until it runs out. The calling
+thread works through chunks too, then waits for the workers to finish.
+**/
+static thread_local bool insidePoolTask = false;                           /// Nested parallelFor() calls run serially
+
+static std::atomic<int> threadsRequested(0);                                /// 0 = one per hardware thread
+static std::atomic<WorkerPool*> currentPool(nullptr);                       /// Read without a lock once created
+
+WorkerPool::WorkerPool(int numThreads)
+{
+    stopping = false;
+    generation = 0;
+    busyWorkers = 0;
+    task = nullptr;
+    for(int i=0; i<numThreads-1; i++)                                       /// The calling thread is the last one
+        workers.push_back(std::thread(&WorkerPool::workerLoop, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(size_t i=0; i<workers.size(); i++)
+        workers[i].join();
+}
+
+static std::mutex poolLock;                                                 /// Guards creation and rebuilding of the pool
+
+WorkerPool& WorkerPool::get()
+{
+    WorkerPool* pool = currentPool.load(std::memory_order_acquire);
+    if(pool != nullptr)
+        return *pool;
+
+    std::lock_guard<std::mutex> lock(poolLock);
+    pool = currentPool.load(std::memory_order_relaxed);
+    if(pool == nullptr)
+    {
+        int n = threadsRequested;
+        if(n<=0)
+            n = std::thread::hardware_concurrency();
+        pool = new WorkerPool(n>0 ? n : 1);
+        currentPool.store(pool, std::memory_order_release);
+    }
+    return *pool;
+}
+
+void WorkerPool::setThreads(int numThreads)
+{
+    std::lock_guard<std::mutex> lock(poolLock);
+    threadsRequested = numThreads;
+    WorkerPool* pool = currentPool.load(std::memory_order_relaxed);
+    if(pool != nullptr && pool->threads() != numThreads)                   /// Only rebuilt if the size actually changes
+    {
+        currentPool.store(nullptr, std::memory_order_release);
+        delete pool;
+    }
+}
+
+int WorkerPool::requestedThreads()
+{
+    return threadsRequested;
+}
+
+void WorkerPool::runChunks()
+{
+    insidePoolTask = true;
+    for(;;)
+    {
+        int begin = nextIndex.fetch_add(chunkSize);
+        if(begin>=taskCount)
+            break;
+        (*task)(begin, std::min(begin+chunkSize, taskCount));
+    }
+    insidePoolTask = false;
+}
+
+void WorkerPool::workerLoop()
+{
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;)
+    {
+        wake.wait(lock, [&]{ return stopping || generation!=seen; });
+        if(stopping)
+            return;
+        seen = generation;
+        lock.unlock();
+        runChunks();
+        lock.lock();
+        if(--busyWorkers==0)
+            finished.notify_one();
+    }
+}
+
+void WorkerPool::parallelFor(int count, const std::function<void(int, int)>& f)
+{
+    if(workers.empty() || count<2 || insidePoolTask)
+    {
+        f(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> oneJobAtATime(jobLock);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &f;
+        taskCount = count;
+        chunkSize = std::max(1, count/(4*threads()));                       /// A few chunks per thread, for load balancing
+        nextIndex = 0;
+        busyWorkers = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]{ return busyWorkers==0; });
+    task = nullptr;
+}
+
+/**
+-------------------------------
+----Fixed-size FFT templates----
+-------------------------------
+For the lengths that are actually deployed, the butterfly stages are instantiated
+from templates so that the stage count, group count and butterfly count are all
+compile-time constants, and the compiler can unroll and vectorize every stage.
+The twiddle factors are generated at compile time (constexpr), in the same
+stage-major layout as FftPlan uses. Since a stage's factors only depend on its
+length, the table for the largest size serves all the smaller ones.
+**/
+#define MAX_FIXED_FFTLEN 65536                                              /// Largest specialized length
+
+#ifdef __GNUC__
+#define FIXED_INLINE inline __attribute__((always_inline))                  /// So that all stages end up in one function
+#else
+#define FIXED_INLINE inline
+#endif
+
+static constexpr double taylorSin(double x)                                 /// Accurate for |x| <= pi/4
+{
+    double x2 = x*x, term = x, sum = x;
+    for(int k=1; k<=10; k++)
+    {
+        term *= -x2/((2*k)*(2*k+1));
+        sum += term;
+    }
+    return sum;
+}
+
+static constexpr double taylorCos(double x)                                 /// Accurate for |x| <= pi/4
+{
+    double x2 = x*x, term = 1, sum = 1;
+    for(int k=1; k<=10; k++)
+    {
+        term *= -x2/((2*k-1)*(2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+static constexpr double constCos(double t);
+
+static constexpr double constSin(double t)                                  /// For 0 <= t <= pi
+{
+    return t>PI/2 ? constSin(PI-t) : (t>PI/4 ? taylorCos(PI/2-t) : taylorSin(t));
+}
+
+static constexpr double constCos(double t)                                  /// For 0 <= t <= pi
+{
+    return t>PI/2 ? -constCos(PI-t) : (t>PI/4 ? taylorSin(PI/2-t) : taylorCos(t));
+}
+
+template<int N>
+struct FixedTwiddles
+{
+    double w[2*N];                                                          /// Interleaved (re, im), stage-major
+
+    constexpr FixedTwiddles() : w()
+    {
+        for(int m=1; m<N; m*=2)
+            for(int j=0; j<m; j++)
+            {
+                w[2*(m-1+j)] = constCos(PI*j/m);
+                w[2*(m-1+j)+1] = -constSin(PI*j/m);
+            }
+    }
+};
+
+static constexpr FixedTwiddles<MAX_FIXED_FFTLEN> fixedTwiddles;
+
+/// Stage merging pairs of length-M transforms, followed (recursively) by all later stages.
+/// Written on plain doubles: std::complex multiplication has NaN handling that stops vectorization.
+template<int N, int M>
+struct FixedStages
+{
+    static FIXED_INLINE void run(double* d)
+    {
+        const double* w = fixedTwiddles.w + 2*(M-1);
+        for(int k=0; k<N; k+=2*M)
+        {
+            double* a = d+2*k;
+            double* b = d+2*(k+M);
+            for(int j=0; j<M; j++)
+            {
+                double tr = w[2*j]*b[2*j] - w[2*j+1]*b[2*j+1];
+                double ti = w[2*j]*b[2*j+1] + w[2*j+1]*b[2*j];
+                b[2*j] = a[2*j] - tr;
+                b[2*j+1] = a[2*j+1] - ti;
+                a[2*j] += tr;
+                a[2*j+1] += ti;
+            }
+        }
+        FixedStages<N, 2*M>::run(d);
+    }
+};
+
+template<int N>
+struct FixedStages<N, N>                                                    /// All stages done
+{
+    static FIXED_INLINE void run(double*) {}
+};
+
+/// Butterfly stages of an N-point FFT. Input must already be in bit-reversed order.
+template<int N>
+static void fixedFftStages(cmplx* data)
+{
+    static_assert(N<=MAX_FIXED_FFTLEN && (N&(N-1))==0, "Fixed-size FFT length must be a power of 2 within the table");
+    FixedStages<N, 1>::run(reinterpret_cast<double*>(data));
+}
+
+#ifdef __GNUC__
+/// Same stages compiled for AVX2/FMA (everything above is inlined into this), for use
+/// when the selected dspKernels() are the AVX2/FMA set.
+template<int N>
+__attribute__((target("avx2,fma")))
+static void fixedFftStagesAVX2(cmplx* data)
+{
+    FixedStages<N, 1>::run(reinterpret_cast<double*>(data));
+}
+#define FIXED_FFT(N) (avx2 ? fixedFftStagesAVX2<N> : fixedFftStages<N>)
+#else
+#define FIXED_FFT(N) fixedFftStages<N>
+#endif
+
+/// Specialized stages for length n, or nullptr if n is not one of the deployed lengths.
+static void (*fixedFftFor(int n))(cmplx*)
+{
+    bool avx2 = dspKernels().avx2;                                          /// Worked out when the kernels were picked
+    (void)avx2;
+    switch(n)
+    {
+        case 4096 : return FIXED_FFT(4096);
+        case 8192 : return FIXED_FFT(8192);
+        case 16384: return FIXED_FFT(16384);
+        case 65536: return FIXED_FFT(65536);
+        default   : return nullptr;
+    }
+}
+
+/// Runs the specialized stages if there are any for this length. Single-precision
+/// transforms have none and always use the generic (SIMD kernel) stages, so with
+/// the float default these only serve the double path. Float on the generic kernels
+/// is still faster than double on the fixed stages (see --benchmark), and
+/// template-generated float stages measured slower than the float SIMD kernels.
+static bool runFixedStages(cmplx* data, int n)
+{
+    void (*stages)(cmplx*) = fixedFftFor(n);
+    if(stages == nullptr)
+        return false;
+    stages(data);
+    return true;
+}
+
+static bool runFixedStages(cmplxf*, int)
+{
+    return false;
+}
+
+/// The kernel matching the precision of the data.
+static void runFftStage(const DSPKernels& k, cmplx* data, int n, const cmplx* w, int m)     { k.fftStage(data, n, w, m); }
+static void runFftStage(const DSPKernels& k, cmplxf* data, int n, const cmplxf* w, int m)  { k.fftStageF(data, n, w, m); }
+static void runWiden(const DSPKernels& k, double* output, const sample* input, int n)      { k.widen(output, input, n); }
+static void runWiden(const DSPKernels& k, float* output, const sample* input, int n)       { k.widenF(output, input, n); }
+static void runMagnitudes(const DSPKernels& k, sample* output, const cmplx* input, int n, float scale)  { k.magnitudes(output, input, n, scale); }
+static void runMagnitudes(const DSPKernels& k, sample* output, const cmplxf* input, int n, float scale) { k.magnitudesF(output, input, n, scale); }
+
+template<typename Real>
+bool BasicFftPlan<Real>::useFixedSize = true;
+
+/**
+--------------------------
+----class BasicFftPlan----
+--------------------------
+Twiddle factors are stored stage after stage so that every butterfly stage reads its
+factors contiguously. The stage that merges pairs of length m (m = 1, 2, 4 ... n/2)
+uses twiddles[m-1] to twiddles[2m-2], where
+    twiddles[m-1+j] = exp(-2*pi*i*j/(2m))
+The last stage's factors, exp(-2*pi*i*k/n) for k < n/2, double as the factors needed
+to untangle a real-input transform.
+
+Non-power-of-2 lengths use Bluestein's algorithm: with c[j] = exp(-pi*i*j^2/n),
+    X[k] = c[k] * sum_j (x[j]*c[j]) * conj(c[k-j])
+which is a convolution, done with power-of-2 FFTs of length convLen >= 2n-1. The FFT
+of the conj(c) filter is precomputed.
+
+Everything is written once for both precisions. Tables are always computed in double
+and then rounded, so single-precision plans only lose accuracy in the transform itself.
+**/
+template<typename Real>
+BasicFftPlan<Real>::BasicFftPlan(int n)
+{
+    len = n;
+    pow2 = isPowerOf2(n);
+    twiddles = nullptr;
+    bitrev = nullptr;
+    realTwiddles = nullptr;
+    chirp = nullptr;
+    chirpFilter = nullptr;
+    convScratch = nullptr;
+    convPlan = nullptr;
+    halfPlan = nullptr;
+    rowPlan = nullptr;
+    columnPlan = nullptr;
+    fourStepBuffer = nullptr;
+    splitMeasured = 0;
+
+    if(pow2)
+    {
+        twiddles = new complex_t[n];
+        for(int m=1; m<n; m*=2)
+            for(int j=0; j<m; j++)
+                twiddles[m-1+j] = (complex_t)std::polar(1.0, -PI*j/m);
+
+        bitrev = new int[n];
+        for(int i=0, j=0; i<n; i++)
+        {
+            bitrev[i] = j;
+            int bit = n>>1;                                                 /// Increment j in bit-reversed order
+            for(; j&bit; bit>>=1)
+                j ^= bit;
+            j |= bit;
+        }
+    }
+    else
+    {
+        convLen = 1;
+        while(convLen<2*n-1)
+            convLen *= 2;
+        convPlan = &BasicFftPlan::get(convLen);
+
+        chirp = new complex_t[n];
+        for(int j=0; j<n; j++)
+        {
+            long long jj = ((long long)j*j)%(2*(long long)n);               /// Reduced to keep the phase accurate for large j
+            chirp[j] = (complex_t)std::polar(1.0, -PI*jj/n);
+        }
+
+        chirpFilter = new complex_t[convLen];
+        for(int j=0; j<convLen; j++)
+            chirpFilter[j] = 0;
+        chirpFilter[0] = conj(chirp[0]);
+        for(int j=1; j<n; j++)
+            chirpFilter[j] = chirpFilter[convLen-j] = conj(chirp[j]);
+        convPlan->forward(chirpFilter, chirpFilter);
+
+        convScratch = new complex_t[convLen];
+    }
+
+    if(n%2==0 && n>=2)                                                      /// Real transforms of even length use a half-length complex FFT
+    {
+        halfPlan = n>=4 ? &BasicFftPlan::get(n/2) : nullptr;
+        if(pow2)
+            realTwiddles = twiddles+n/2-1;
+        else
+        {
+            realTwiddles = new complex_t[n/2];
+            for(int k=0; k<n/2; k++)
+                realTwiddles[k] = (complex_t)std::polar(1.0, -2*PI*k/n);
+        }
+    }
+
+    scratch = new complex_t[n];
+
+    if(pow2 && n>=PARALLEL_FFT_THRESHOLD)                                   /// Four-step split: n = rows*cols, rows <= cols
+    {
+        int logn = 0;
+        while((1<<logn)<n)
+            logn++;
+        rows = 1<<(logn/2);
+        cols = n/rows;
+        columnPlan = &BasicFftPlan::get(rows);
+        rowPlan = &BasicFftPlan::get(cols);
+    }
+}
+
+template<typename Real>
+BasicFftPlan<Real>::~BasicFftPlan()
+{
+    delete[] twiddles;
+    delete[] bitrev;
+    if(!pow2)
+        delete[] realTwiddles;
+    delete[] chirp;
+    delete[] chirpFilter;
+    delete[] convScratch;
+    delete[] scratch;
+    delete[] fourStepBuffer;
+}
+
+template<typename Real>
+std::map<int, BasicFftPlan<Real>*>& BasicFftPlan<Real>::cache()
+{
+    static std::map<int, BasicFftPlan*> plans;
+    return plans;
+}
+
+template<typename Real>
+std::recursive_mutex& BasicFftPlan<Real>::cacheLock()
+{
+    static std::recursive_mutex lock;                                       /// Recursive: Bluestein plans fetch their power-of-2 plans while being built
+    return lock;
+}
+
+template<typename Real>
+BasicFftPlan<Real>& BasicFftPlan<Real>::get(int n)                          /// Cached plan for length n
+{
+    std::lock_guard<std::recursive_mutex> lock(cacheLock());
+    BasicFftPlan*& plan = cache()[n];
+    if(plan == nullptr)
+        plan = new BasicFftPlan(n);
+    return *plan;
+}
+
+template<typename Real>
+size_t BasicFftPlan<Real>::memoryUsage() const
+{
+    size_t complexValues = len;                                             /// scratch
+    if(pow2)
+        complexValues += len;                                               /// twiddles (realTwiddles point into them)
+    else
+        complexValues += len + 2*convLen + (len%2==0 ? len/2 : 0);          /// chirp, chirpFilter, convScratch, realTwiddles
+    if(fourStepBuffer != nullptr)
+        complexValues += len;
+    return sizeof(BasicFftPlan) + complexValues*sizeof(complex_t) + (pow2 ? len*sizeof(int) : 0);
+}
+
+template<typename Real>
+size_t BasicFftPlan<Real>::cacheMemory()
+{
+    std::lock_guard<std::recursive_mutex> lock(cacheLock());
+    size_t total = 0;
+    for(auto& entry : cache())
+        total += entry.second->memoryUsage();
+    return total;
+}
+
+template<typename Real>
+void BasicFftPlan<Real>::forward(complex_t* output, const complex_t* input) /// n-point complex FFT. Can be done in-place.
 {
+    int n = len;
     if(n==1)
     {
         output[0] = input[0];
         return;
     }
 
-    cmplx* even = new cmplx[n/2];
-    for(int i=0; i<n/2; i++)
-        even[i] = input[2*i];
-    cmplx* odd = new cmplx[n/2];
-    for(int i=0; i<n/2; i++)
-        odd[i] = input[2*i+1];
-
-    cmplx* evenOut = new cmplx[n/2];
-    fft(evenOut, even, n/2);
-    cmplx* oddOut = new cmplx[n/2];
-    fft(oddOut, odd, n/2);
+    if(!pow2)
+    {
+        /// Bluestein: premultiply by chirp, convolve with conj(chirp), postmultiply by chirp.
+        /// The inverse FFT of the convolution is done as conj(FFT(conj(.)))/convLen.
+        for(int j=0; j<n; j++)
+            convScratch[j] = input[j]*chirp[j];
+        for(int j=n; j<convLen; j++)
+            convScratch[j] = 0;
+        convPlan->forward(convScratch, convScratch);
+        for(int j=0; j<convLen; j++)
+            convScratch[j] = conj(convScratch[j]*chirpFilter[j]);
+        convPlan->forward(convScratch, convScratch);
+        for(int k=0; k<n; k++)
+            output[k] = chirp[k]*conj(convScratch[k])/(Real)convLen;
+        return;
+    }
 
-    for(int i=0; i<n/2; i++)
+    if(columnPlan != nullptr && splitPays(input))
     {
-        cmplx t = exp(cmplx(0, -2*3.14159*i/n))*oddOut[i];
-        output[i] = evenOut[i] + t;
-        output[i+n/2] = evenOut[i] - t;
+        forwardParallel(output, input);
+        return;
     }
 
-    delete[] even;
-    delete[] odd;
-    delete[] evenOut;
-    delete[] oddOut;
+    /// Bit-reversal permutation. Done with swaps if working in-place, or as a
+    /// scattered copy otherwise.
+    if(output == input)
+    {
+        for(int i=0; i<n; i++)
+            if(i<bitrev[i])
+                std::swap(output[i], output[bitrev[i]]);
+    }
+    else
+    {
+        for(int i=0; i<n; i++)
+            output[bitrev[i]] = input[i];
+    }
 
-    return;
+    /// Butterfly stages. Each stage merges pairs of length-m transforms into length-2m transforms.
+    if(useFixedSize && runFixedStages(output, n))
+        return;
+    const DSPKernels& kernels = dspKernels();
+    for(int m=1; m<n; m*=2)
+        runFftStage(kernels, output, n, twiddles+m-1, m);
 }
 
 /**
-----FindFrequencyContent()----
-Takes pointer to an array of audio samples, performs FFT, and outputs magnitude of
-complex coefficients.
-i.e., it give amplitude but not phase of frequency components in given audio.
+----BasicFftPlan::forwardParallel()----
+Four-step FFT. Writing n = n1*n2 and indices j = j1*n2 + j2, k = k1 + n1*k2:
+    X[k1 + n1*k2] = sum_j2 [ w_n^(j2*k1) * (sum_j1 x[j1*n2 + j2] * w_n1^(j1*k1)) ] * w_n2^(j2*k2)
+1. n2 independent n1-point FFTs down the columns (stride n2) of x, each multiplied by
+   the twiddles w_n^(j2*k1) and stored as a contiguous row of fourStepBuffer.
+2. n1 independent n2-point FFTs across fourStepBuffer (stride n1), each scattered to
+   its final positions k1 + n1*k2.
+Columns and rows are moved in blocks of FOUR_STEP_BLOCK so that the strided accesses
+still use whole cache lines.
+Each step is split across the worker pool; only one synchronization point in between.
+w_n^e for e >= n/2 is -w_n^(e-n/2), so the last stage of the twiddle table covers it.
 **/
-void FindFrequencyContent(sample* output, sample* input, int n, float vScale)
+template<typename Real>
+static std::complex<Real>* threadBuffer(int n)                              /// Per-thread scratch, grown on demand
+{
+    static thread_local std::vector< std::complex<Real> > buffer;
+    if((int)buffer.size()<n)
+        buffer.resize(n);
+    return buffer.data();
+}
+
+template<typename Real>
+bool BasicFftPlan<Real>::splitPays(const complex_t* input)
+{
+    int requested = WorkerPool::requestedThreads();
+    if(requested != 0)                                                      /// --threads=N decides
+        return requested > 1;
+    if(splitMeasured == 0)
+        splitMeasured = WorkerPool::get().threads()>1 && parallelIsFaster(input) ? 1 : -1;
+    return splitMeasured > 0;
+}
+
+/// Best of SPLIT_TRIALS transforms each way, into a buffer of its own so that input is
+/// left alone even when the caller is working in-place.
+template<typename Real>
+bool BasicFftPlan<Real>::parallelIsFaster(const complex_t* input)
 {
-    cmplx* fftin = new cmplx[n];
-    cmplx* fftout = new cmplx[n];
-    for(int i=0; i<n; i++)                                                  /// Convert input to complex
-        fftin[i] = (cmplx)input[i];
-    fft(fftout, fftin, n);                                                  /// FFT
-    for(int i=0; i<n; i++)                                                  /// Convert output to real samples
+    typedef std::chrono::steady_clock clock;
+    complex_t* trial = new complex_t[len];
+    double serial = 1e30, parallel = 1e30;
+    splitMeasured = -1;                                                     /// So that forward() stays serial meanwhile
+    for(int i=0; i<SPLIT_TRIALS; i++)
     {
-        double currentvalue = abs(fftout[i])*vScale;
-        output[i] = (sample)(currentvalue>MAX_SAMPLE_VALUE ? MAX_SAMPLE_VALUE : currentvalue);
+        clock::time_point start = clock::now();
+        forward(trial, input);
+        clock::time_point middle = clock::now();
+        forwardParallel(trial, input);
+        clock::time_point end = clock::now();
+        serial = std::min(serial, std::chrono::duration<double>(middle-start).count());
+        parallel = std::min(parallel, std::chrono::duration<double>(end-middle).count());
     }
+    delete[] trial;
+    if(parallel < SPLIT_MARGIN*serial)
+        return true;
+    delete[] fourStepBuffer;                                                /// Won't be needed
+    fourStepBuffer = nullptr;
+    return false;
+}
+
+template<typename Real>
+void BasicFftPlan<Real>::forwardParallel(complex_t* output, const complex_t* input)
+{
+    int n = len;
+    int n1 = rows;
+    int n2 = cols;
+    const complex_t* w = twiddles+n/2-1;                                    /// w[e] = exp(-2*pi*i*e/n), e < n/2
+    if(fourStepBuffer == nullptr)
+        fourStepBuffer = new complex_t[n];
+    complex_t* T = fourStepBuffer;
+    WorkerPool& pool = WorkerPool::get();
+
+    const int B = FOUR_STEP_BLOCK;                                          /// Columns/rows moved together, so strided accesses still use whole cache lines
 
-    delete[] fftin;
-    delete[] fftout;
+    pool.parallelFor(n2/B, [&](int begin, int end)
+    {
+        for(int j2b=begin*B; j2b<end*B; j2b+=B)
+        {
+            for(int j1=0; j1<n1; j1++)                                      /// Transpose a block of columns into rows of T
+                for(int b=0; b<B; b++)
+                    T[(j2b+b)*n1+j1] = input[j1*n2+j2b+b];
+            for(int j2=j2b; j2<j2b+B; j2++)
+            {
+                complex_t* column = T+j2*n1;
+                columnPlan->forward(column, column);
+                for(int k1=1, e=j2; k1<n1; k1++, e+=j2)                     /// e = j2*k1 < n
+                {
+                    complex_t t = (e<n/2) ? w[e] : -w[e-n/2];
+                    Real re = column[k1].real(), im = column[k1].imag();
+                    column[k1] = complex_t(re*t.real() - im*t.imag(), re*t.imag() + im*t.real());
+                }
+            }
+        }
+    });
+
+    pool.parallelFor(n1/B, [&](int begin, int end)
+    {
+        complex_t* rowBlock = threadBuffer<Real>(B*n2);
+        for(int k1b=begin*B; k1b<end*B; k1b+=B)
+        {
+            for(int j2=0; j2<n2; j2++)                                      /// Gather a block of rows
+                for(int b=0; b<B; b++)
+                    rowBlock[b*n2+j2] = T[j2*n1+k1b+b];
+            for(int b=0; b<B; b++)
+                rowPlan->forward(rowBlock+b*n2, rowBlock+b*n2);
+            for(int k2=0; k2<n2; k2++)                                      /// Scatter to final positions k1 + n1*k2
+                for(int b=0; b<B; b++)
+                    output[k1b+b+n1*k2] = rowBlock[b*n2+k2];
+        }
+    });
 }
 
+/**
+----FftPlan::forwardReal()----
+Packs the n real samples into n/2 complex numbers (even samples as real parts, odd
+samples as imaginary parts), performs an n/2-point FFT and then untangles the spectra
+of the even and odd samples:
+    X[k] = (Z[k] + conj(Z[n/2-k]))/2 - i*exp(-2*pi*i*k/n)*(Z[k] - conj(Z[n/2-k]))/2
+Bins k and n/2-k are computed together so that this can be done in-place.
+Odd lengths fall back to a full complex transform.
+
+Packing is just widening the samples into the output array seen as 2*(n/2) reals, so
+the two runs of an AudioView are widened one after the other, wherever the wrap point
+falls. The window is applied to the widened samples, so windowing costs no extra
+rounding.
+**/
+template<typename Real>
+void BasicFftPlan<Real>::forwardReal(complex_t* output, const sample* input)
+{
+    AudioView whole = {input, len, nullptr, 0};
+    forwardReal(output, whole);
+}
 
+template<typename Real>
+void BasicFftPlan<Real>::forwardReal(complex_t* output, const AudioView& input, const float* window)
+{
+    int n = len;
+    if(n%2==1)
+    {
+        for(int i=0; i<n; i++)
+            scratch[i] = window ? input[i]*window[i] : input[i];
+        forward(scratch, scratch);
+        for(int k=0; k<=n/2; k++)
+            output[k] = scratch[k];
+        return;
+    }
+
+    int h = n/2;
+    Real* x = reinterpret_cast<Real*>(output);                              /// z[k] = x[2k] + i*x[2k+1]
+    runWiden(dspKernels(), x, input.first, input.firstLength);
+    runWiden(dspKernels(), x+input.firstLength, input.second, input.secondLength);
+    if(window != nullptr)
+        for(int i=0; i<n; i++)
+            x[i] *= window[i];
+
+    if(halfPlan != nullptr)
+        halfPlan->forward(output, output);                                  /// Half-length complex FFT
+
+    const complex_t* w = realTwiddles;                                      /// w[k] = exp(-2*pi*i*k/n), k < n/2
+    complex_t z0 = output[0];
+    output[0] = complex_t(z0.real()+z0.imag(), 0);                          /// DC and Nyquist bins are purely real
+    output[h] = complex_t(z0.real()-z0.imag(), 0);
+    for(int k=1; k<=h/2; k++)
+    {
+        complex_t zk = output[k];
+        complex_t zc = conj(output[h-k]);
+        complex_t even = (Real)0.5*(zk+zc);                                 /// Spectrum of even samples at bin k
+        complex_t odd = complex_t(0, -0.5)*(zk-zc);                         /// Spectrum of odd samples at bin k
+        output[k] = even + w[k]*odd;
+        output[h-k] = conj(even - w[k]*odd);                                /// Same untangling for bin n/2-k, by symmetry
+    }
+}
+
+template class BasicFftPlan<double>;
+template class BasicFftPlan<float>;
+
+void fft(cmplx* output, cmplx* input, int n)                                /// Iterative in-place FFT (any length)
+{
+    FftPlan::get(n).forward(output, input);
+}
+
+void rfft(cmplx* output, sample* input, int n)                              /// Real-input FFT
+{
+    FftPlan::get(n).forwardReal(output, input);
+}
+
+/**
+----FFT length----
+Number of samples the visualizers perform FFT on. Can be changed at runtime; plans
+for every length used are cached, so switching back and forth costs nothing.
+**/
+static int currentFFTLength = DEFAULT_FFTLEN;
+
+int getFFTLength()
+{
+    return currentFFTLength;
+}
+
+bool setFFTLength(int n)
+{
+    if(n<MIN_FFTLEN || n>MAX_FFTLEN)
+        return false;
+    currentFFTLength = n;
+    if(getSinglePrecision())                                                /// Build the plan now rather than on the first frame
+        FftPlanF::get(n);
+    else
+        FftPlan::get(n);
+    return true;
+}
+
+/**
+----Analysis precision----
+Whether FindFrequencyContent() works in float or double.
+**/
+static bool singlePrecision = SINGLE_PRECISION_DEFAULT;
+
+bool getSinglePrecision()
+{
+    return singlePrecision;
+}
+
+void setSinglePrecision(bool enable)
+{
+    singlePrecision = enable;
+}
+
+/**
+----Analysis window----
+Hann is the usual compromise. Blackman-Harris (4-term, -92dB sidelobes) keeps quiet
+partials from drowning in the leakage of loud ones, at the cost of wider peaks.
+Tables are kept for every (window, length) pair used, like FFT plans.
+**/
+static WindowType analysisWindow = HANN_WINDOW;
+
+static const double windowCoefficientTable[][4] =
+{
+    {1, 0, 0, 0},                                                           /// Rectangular
+    {0.5, 0.5, 0, 0},                                                       /// Hann
+    {0.35875, 0.48829, 0.14128, 0.01168}                                    /// Blackman-Harris
+};
+static const char* windowNames[] = {"rectangular", "hann", "blackman-harris"};
+
+WindowType getAnalysisWindow()
+{
+    return analysisWindow;
+}
+
+void setAnalysisWindow(WindowType window)
+{
+    analysisWindow = window;
+}
+
+bool setAnalysisWindow(const char* name)
+{
+    for(int w=RECTANGULAR_WINDOW; w<=BLACKMAN_HARRIS_WINDOW; w++)
+        if(strcmp(name, windowNames[w])==0)
+        {
+            analysisWindow = (WindowType)w;
+            return true;
+        }
+    return false;
+}
+
+const char* windowName(WindowType window)
+{
+    return windowNames[window];
+}
+
+const double* windowCoefficients(WindowType window)
+{
+    return windowCoefficientTable[window];
+}
+
+int windowTerms(WindowType window)
+{
+    int terms = 3;
+    while(terms>0 && windowCoefficientTable[window][terms]==0)
+        terms--;
+    return terms;
+}
+
+double windowGain(WindowType window)
+{
+    return windowCoefficientTable[window][0];
+}
+
+static std::map<std::pair<int, int>, float*> windowTableCache;            /// Keyed by (window, n)
+static std::mutex windowTableLock;
+
+const float* windowTable(WindowType window, int n)
+{
+    std::lock_guard<std::mutex> lock(windowTableLock);
+    float*& table = windowTableCache[std::make_pair((int)window, n)];
+    if(table == nullptr)
+    {
+        const double* a = windowCoefficientTable[window];
+        table = new float[n];
+        for(int i=0; i<n; i++)
+        {
+            double x = 2*PI*i/n;
+            table[i] = a[0] - a[1]*cos(x) + a[2]*cos(2*x) - a[3]*cos(3*x);
+        }
+    }
+    return table;
+}
+
+size_t windowTableMemory()
+{
+    std::lock_guard<std::mutex> lock(windowTableLock);
+    size_t total = 0;
+    for(auto& entry : windowTableCache)
+        total += entry.first.second*sizeof(float);
+    return total;
+}
+
+void applyWindow(sample* data, int n, WindowType window)
+{
+    if(window == RECTANGULAR_WINDOW)
+        return;
+    dspKernels().weight(data, data, windowTable(window, n), n);
+}
+
+/**
+----Hop size----
+Samples between STFT frames.
+**/
+static int currentHopSize = DEFAULT_HOP;
+
+int getHopSize()
+{
+    return currentHopSize;
+}
+
+bool setHopSize(int n)
+{
+    if(n<1 || n>MAX_FFTLEN)
+        return false;
+    currentHopSize = n;
+    return true;
+}
+
+int queueLengthFor(int n, int hop)
+{
+    long long needed = ((2*(long long)n+hop)*4+2)/3;                       /// Reach-back must fit in three quarters of the queue
+    int len = 1;
+    while(len < needed)
+        len *= 2;
+    return len;
+}
+
+/**
+----FindFrequencyContent()----
+Takes pointer to an array of audio samples, performs FFT, and outputs magnitude of
+complex coefficients.
+i.e., it give amplitude but not phase of frequency components in given audio.
+Since the input is real, only the n/2+1 non-redundant bins are computed and written.
+**/
+template<typename Real>
+static void FrequencyContent(sample* output, const AudioView& input, const float* window, int n, float vScale)
+{
+    BasicFftPlan<Real>& plan = BasicFftPlan<Real>::get(n);
+    std::complex<Real>* fftout = plan.scratchBuffer();                      /// Preallocated, no per-call allocation
+    plan.forwardReal(fftout, input, window);                                /// Real-input FFT
+    runMagnitudes(dspKernels(), output, fftout, n/2+1, vScale);             /// Convert output to real samples
+}
+
+void FindFrequencyContent(sample* output, const AudioView& input, const float* window, int n, float vScale)
+{
+    if(singlePrecision)
+        FrequencyContent<float>(output, input, window, n, vScale);
+    else
+        FrequencyContent<double>(output, input, window, n, vScale);
+}
+
+void FindFrequencyContent(sample* output, sample* input, int n, float vScale)
+{
+    AudioView whole = {input, n, nullptr, 0};
+    FindFrequencyContent(output, whole, nullptr, n, vScale);
+}
+
+/**
+----Goertzel filter bank----
+For bin k the recurrence s[i] = x[i] + 2cos(2*pi*k/n)*s[i-1] - s[i-2] runs over all n
+samples, after which |X[k]|^2 = s1^2 + s2^2 - 2cos(2*pi*k/n)*s1*s2. Always in double
+precision: in float the recurrence loses too much accuracy for low bins of long inputs.
+The samples are widened once into a buffer of the bank's own and shared by all threads,
+which take GOERTZEL_GROUP bins at a time. The buffers are kept from call to call (one
+set per calling thread), and the coefficients are only worked out again when the bins
+or the length change.
+**/
+#define GOERTZEL_GROUP 16
+
+struct GoertzelBuffers
+{
+    std::vector<double> samples;                                        /// Widened input
+    std::vector<int> bins;                                              /// Bins the coefficients are for
+    int len = 0;                                                        /// Length they are for
+    std::vector<double> coeff;                                          /// 2cos(2*pi*bin/len)
+    std::vector<double> power;                                          /// Squared magnitudes
+};
+
+static thread_local GoertzelBuffers goertzelBuffers;
+
+void GoertzelContent(sample* output, const sample* input, int n, const int* bins, int numBins, float vScale)
+{
+    const DSPKernels& kernels = dspKernels();
+    GoertzelBuffers& buffers = goertzelBuffers;
+    if((int)buffers.samples.size() < n)
+        buffers.samples.resize(n);
+    double* samples = buffers.samples.data();
+    kernels.widen(samples, input, n);
+    if(buffers.len != n || (int)buffers.bins.size() != numBins || !std::equal(bins, bins+numBins, buffers.bins.begin()))
+    {
+        buffers.len = n;
+        buffers.bins.assign(bins, bins+numBins);
+        buffers.coeff.resize(numBins);
+        buffers.power.resize(numBins);
+        for(int k=0; k<numBins; k++)
+            buffers.coeff[k] = 2*cos(2*PI*bins[k]/n);
+    }
+    const double* coeff = buffers.coeff.data();
+    double* power = buffers.power.data();
+
+    int groups = (numBins+GOERTZEL_GROUP-1)/GOERTZEL_GROUP;
+    WorkerPool::get().parallelFor(groups, [&](int begin, int end)
+    {
+        int first = begin*GOERTZEL_GROUP;
+        int last = std::min(end*GOERTZEL_GROUP, numBins);
+        kernels.goertzel(power+first, coeff+first, last-first, samples, n);
+    });
+
+    for(int k=0; k<numBins; k++)
+    {
+        double currentvalue = sqrt(std::max(power[k], 0.0))*vScale;
+        output[bins[k]] = (sample)(currentvalue>MAX_SAMPLE_VALUE ? MAX_SAMPLE_VALUE : currentvalue);
+    }
+}
+
+/// FindFrequencyContent() costs roughly n*log2(n) butterfly-sized units. The Goertzel
+/// kernels run a group of GOERTZEL_GROUP bins through the samples in about 4n units,
+/// and the pool's threads each take a group at a time.
+bool goertzelIsFaster(int n, int numBins)
+{
+    int log2n = 0;
+    while((1<<log2n) < n)
+        log2n++;
+    int groups = (numBins+GOERTZEL_GROUP-1)/GOERTZEL_GROUP;
+    int threads = WorkerPool::get().threads();
+    int rounds = (groups+threads-1)/threads;
+    return 4.0*n*rounds < (double)n*log2n;
+}
+
+void FindBinContent(sample* output, sample* input, int n, const int* bins, int numBins, float vScale)
+{
+    if(goertzelIsFaster(n, numBins))
+        GoertzelContent(output, input, n, bins, numBins, vScale);
+    else
+        FindFrequencyContent(output, input, n, vScale);
+}
+
+/**
+----CheckSinglePrecision()----
+Transforms the same input in both precisions and compares.
+**/
+PrecisionReport CheckSinglePrecision(sample* input, int n, float vScale)
+{
+    PrecisionReport report;
+
+    FftPlan& plan = FftPlan::get(n);
+    FftPlanF& planF = FftPlanF::get(n);
+    cmplx* spectrum = new cmplx[n/2+1];
+    cmplxf* spectrumF = new cmplxf[n/2+1];
+    plan.forwardReal(spectrum, input);
+    planF.forwardReal(spectrumF, input);
+
+    double largest = 0;
+    double largestError = 0;
+    for(int k=0; k<=n/2; k++)
+    {
+        largest = std::max(largest, abs(spectrum[k]));
+        largestError = std::max(largestError, abs(spectrum[k] - (cmplx)spectrumF[k]));
+    }
+    report.relativeError = largest>0 ? largestError/largest : 0;
+
+    sample* magnitudes = new sample[n/2+1];
+    sample* magnitudesF = new sample[n/2+1];
+    runMagnitudes(dspKernels(), magnitudes, spectrum, n/2+1, vScale);
+    runMagnitudes(dspKernels(), magnitudesF, spectrumF, n/2+1, vScale);
+    report.maxMagnitudeDifference = 0;
+    for(int k=0; k<=n/2; k++)
+        report.maxMagnitudeDifference = std::max(report.maxMagnitudeDifference, abs(magnitudes[k]-magnitudesF[k]));
+
+    delete[] spectrum;
+    delete[] spectrumF;
+    delete[] magnitudes;
+    delete[] magnitudesF;
+    return report;
+}
+
+/**
+------------------------
+----class SlidingDFT----
+------------------------
+The window covers queue positions [position-n, position). Bins are kept in double
+precision whatever getSinglePrecision() says: the recursive update accumulates rounding
+error, and double keeps it far below one output unit between resyncs.
+
+Multiplying by w[i] = cos(2*pi*m*i/n) turns bin k into (X[k-m] + X[k+m])/2, so a
+cosine-sum window is applied to the bins as
+    Y[k] = a0*X[k] + sum over m of (-1)^m*(am/2)*(X[k-m] + X[k+m])
+**/
+SlidingDFT::SlidingDFT()
+{
+    len = 0;
+    firstBin = lastBin = 0;
+    bandFirst = bandLast = 0;
+    window = RECTANGULAR_WINDOW;
+    bins = nullptr;
+    windowed = nullptr;
+    rotation = nullptr;
+    incoming = nullptr;
+    outgoing = nullptr;
+    delta = nullptr;
+    position = 0;
+    lastResync = 0;
+    valid = false;
+    slidingUpdates = fullUpdates = 0;
+}
+SlidingDFT::~SlidingDFT()
+{
+    delete[] bins;
+    delete[] windowed;
+    delete[] rotation;
+    delete[] incoming;
+    delete[] outgoing;
+    delete[] delta;
+}
+
+void SlidingDFT::configure(int n, int k0, int k1, WindowType w)            /// Reallocate for a new length, band or window
+{
+    if(incoming == nullptr)                                                 /// Same size for every n
+    {
+        incoming = new sample[ANALYSIS_CHUNK];
+        outgoing = new sample[ANALYSIS_CHUNK];
+        delta = new double[ANALYSIS_CHUNK];
+    }
+    len = n;
+    bandFirst = k0;
+    bandLast = k1;
+    window = w;
+    firstBin = std::max(k0-windowTerms(w), 0);
+    lastBin = std::min(k1+windowTerms(w), n/2+1);
+
+    delete[] bins;
+    delete[] rotation;
+    delete[] windowed;
+    bins = new cmplx[lastBin-firstBin];
+    rotation = new cmplx[lastBin-firstBin];
+    windowed = new cmplx[k1-k0];
+    for(int k=firstBin; k<lastBin; k++)
+        rotation[k-firstBin] = std::polar(1.0, 2*PI*k/n);
+    valid = false;
+}
+
+bool SlidingDFT::recompute(AudioQueue& queue, unsigned long long end)      /// Full FFT of the n samples before end
+{
+    AudioView samples;
+    if(!queue.view(samples, end-len, len))
+        return false;
+    FftPlan& plan = FftPlan::get(len);
+    cmplx* spectrum = plan.scratchBuffer();
+    plan.forwardReal(spectrum, samples);                                    /// Straight from the queue
+    if(!queue.stillThere(end-len))
+        return false;
+    memcpy(bins, spectrum+firstBin, (lastBin-firstBin)*sizeof(cmplx));
+    position = lastResync = end;
+    valid = true;
+    fullUpdates++;
+    return true;
+}
+
+bool SlidingDFT::slide(AudioQueue& queue, unsigned long long end)          /// Slide the window from position up to end
+{
+    while(position < end)                                                   /// position stays valid if a chunk fails
+    {
+        /// end-position is only bounded by the cost test and the resync interval, and can
+        /// exceed n, so the chunk size is what keeps this within the buffers.
+        int count = std::min(end-position, (unsigned long long)ANALYSIS_CHUNK);
+        if(!queue.peekAt(incoming, position, count) || !queue.peekAt(outgoing, position-len, count))
+            return false;
+        for(int i=0; i<count; i++)
+            delta[i] = incoming[i]-outgoing[i];
+        dspKernels().slideBins(bins, rotation, lastBin-firstBin, delta, count);
+        position += count;
+    }
+    slidingUpdates++;
+    return true;
+}
+
+size_t SlidingDFT::memoryUsage() const
+{
+    if(incoming == nullptr)
+        return 0;
+    return ANALYSIS_CHUNK*(2*sizeof(sample)+sizeof(double)) + (2*(lastBin-firstBin)+bandLast-bandFirst)*sizeof(cmplx);
+}
+
+cmplx SlidingDFT::bin(int k) const
+{
+    if(k < 0)                                                               /// X[-k] = conj(X[k]) for real input
+        return conj(bins[-k-firstBin]);
+    if(k > len/2)                                                           /// And X[n-k] = conj(X[k])
+        return conj(bins[len-k-firstBin]);
+    return bins[k-firstBin];
+}
+
+bool SlidingDFT::update(sample* output, AudioQueue& queue, unsigned long long end, int n, int k0, int k1,
+                        WindowType w, float vScale)
+{
+    k0 = std::max(k0, 0);
+    k1 = std::min(k1, n/2+1);                                               /// Only the non-redundant bins
+    if(k1 <= k0)
+        return true;
+    if(n != len || k0 != bandFirst || k1 != bandLast || w != window)
+        configure(n, k0, k1, w);
+
+    if(end < (unsigned long long)n)
+        return false;
+
+    /// Sliding costs one complex multiply per bin per new sample, the FFT roughly
+    /// n*log2(n)/2 butterflies. With the SIMD kernels a sliding update takes about half
+    /// as long as a butterfly, since the bins stay in registers.
+    int log2n = 0;
+    while((1<<log2n) < n)
+        log2n++;
+    double fftCost = 0.5*(double)n*log2n;
+    double slidingCost = valid && end > position ? 0.5*(double)(end-position)*(lastBin-firstBin) : fftCost+1;
+
+    bool done = false;
+    if(valid && end == position)                                           /// Nothing new since the last frame
+        done = true;
+    else if(slidingCost < fftCost && end-lastResync < SDFT_RESYNC_SAMPLES)
+        done = slide(queue, end);
+    if(!done)
+        done = recompute(queue, end);
+    if(!done)
+        return false;
+
+    if(window == RECTANGULAR_WINDOW)
+    {
+        runMagnitudes(dspKernels(), output+k0, bins, k1-k0, vScale);
+        return true;
+    }
+    const double* a = windowCoefficients(window);
+    int terms = windowTerms(window);
+    for(int k=k0; k<k1; k++)
+    {
+        cmplx y = a[0]*bin(k);
+        for(int m=1; m<=terms; m++)
+            y += (m%2 ? -0.5 : 0.5)*a[m]*(bin(k-m) + bin(k+m));
+        windowed[k-k0] = y;
+    }
+    runMagnitudes(dspKernels(), output+k0, windowed, k1-k0, vScale/windowGain(window));
+    return true;
+}
+
+/**
+----designLowPass()----
+Blackman-windowed sinc low-pass filter with the given cutoff (cycles per sample) and
+unit gain at 0Hz. Its transition band is about 5.5/taps wide, centred on the cutoff.
+**/
+static void designLowPass(double* h, int taps, double cutoff)
+{
+    double sum = 0;
+    for(int l=0; l<taps; l++)
+    {
+        double t = l-(taps-1)/2.0;
+        double sinc = t==0 ? 2*cutoff : sin(2*PI*cutoff*t)/(PI*t);
+        double window = 0.42 - 0.5*cos(2*PI*l/(taps-1)) + 0.08*cos(4*PI*l/(taps-1));
+        h[l] = sinc*window;
+        sum += h[l];
+    }
+    for(int l=0; l<taps; l++)
+        h[l] /= sum;
+}
+
+/**
+---------------------
+----class ZoomFFT----
+---------------------
+The low-pass filter is a Blackman-windowed sinc with cutoff at half the decimated
+band, i.e. n/(2D) bins. The band is kept within the inner half of the decimated band,
+where the filter is flat, and everything that could alias onto it lies beyond the
+transition band (Blackman: about 5.5/ZOOM_FILTER_LENGTH of the decimated band wide).
+**/
+ZoomFFT::ZoomFFT()
+{
+    len = firstBin = lastBin = centreBin = 0;
+    factor = zoomLen = taps = 0;
+    filterRe = filterIm = nullptr;
+    history = nullptr;
+    historyPos = 0;
+    input = nullptr;
+    chunkOutputs = 0;
+    magnitudeBuffer = nullptr;
+    nextOutput = 0;
+    valid = false;
+}
+ZoomFFT::~ZoomFFT()
+{
+    delete[] filterRe;
+    delete[] filterIm;
+    delete[] history;
+    delete[] input;
+    delete[] magnitudeBuffer;
+}
+
+int ZoomFFT::decimationFor(int n, int k0, int k1)
+{
+    int width = k1-k0;
+    if(width <= 0)
+        return 1;
+    int D = 1;
+    while(n%(2*D)==0 && n/(2*D) >= 2*width                                  /// Band no wider than half the zoomed FFT
+          && ZOOM_FILTER_LENGTH*2*D <= n)                                   /// and the filter no longer than n
+        D *= 2;
+    /// Negative frequencies (and their mirror images above Nyquist) reach the band only
+    /// through the stopband, as long as the band itself stays clear of 0Hz and Nyquist.
+    if(D < MIN_ZOOM_DECIMATION || k0 < 1 || k1 > n/2)
+        return 1;
+    return D;
+}
+
+void ZoomFFT::configure(int n, int k0, int k1, int D)
+{
+    delete[] filterRe;
+    delete[] filterIm;
+    delete[] history;
+    delete[] input;
+    delete[] magnitudeBuffer;
+
+    len = n;
+    firstBin = k0;
+    lastBin = k1;
+    centreBin = (k0+k1)/2;
+    factor = D;
+    zoomLen = n/D;
+    taps = ZOOM_FILTER_LENGTH*D;
+
+    filterRe = new double[taps];
+    filterIm = new double[taps];
+    designLowPass(filterRe, taps, 0.5/D);
+    for(int l=0; l<taps; l++)                                               /// Shifted up to centreBin
+    {
+        double h = filterRe[l];
+        double phase = 2*PI*(double)((long long)centreBin*l%n)/n;
+        filterRe[l] = h*cos(phase);
+        filterIm[l] = h*sin(phase);
+    }
+
+    history = new cmplx[zoomLen];
+    historyPos = 0;
+    chunkOutputs = std::max(ANALYSIS_CHUNK/D, 1);
+    input = new sample[(chunkOutputs-1)*D+taps];
+    magnitudeBuffer = new cmplx[k1-k0];
+    valid = false;
+}
+
+cmplx ZoomFFT::filtered(const sample* x, unsigned long long position)
+{
+    /// y = sum over l of x[position-l]*filter[l], then shifted down by centreBin:
+    /// multiplied by exp(-2*pi*i*centreBin*position/n).
+    double re = 0, im = 0;
+    const sample* newest = x+taps-1;
+    for(int l=0; l<taps; l++)
+    {
+        re += newest[-l]*filterRe[l];
+        im += newest[-l]*filterIm[l];
+    }
+    double phase = -2*PI*(double)((centreBin*(position%len))%len)/len;
+    return cmplx(re, im)*cmplx(cos(phase), sin(phase));
+}
+
+bool ZoomFFT::update(sample* output, AudioQueue& queue, unsigned long long end, int n, int k0, int k1,
+                     WindowType window, float vScale)
+{
+    int D = decimationFor(n, k0, k1);
+    if(D == 1)
+        return false;
+    if(n != len || k0 != firstBin || k1 != lastBin || D != factor)
+        configure(n, k0, k1, D);
+
+    /// Filtered samples are taken at positions that are multiples of D, up to the newest
+    /// sample before end. If more than a whole history's worth is missing, start afresh.
+    if(end < (unsigned long long)(n+taps))
+        return false;
+    unsigned long long last = (end-1)/D*D;                                  /// Newest position to filter
+    unsigned long long first = last-(unsigned long long)(zoomLen-1)*D;
+    if(valid && nextOutput > last+D)                                        /// An older frame than last time
+        valid = false;
+    if(valid && nextOutput > first)
+        first = nextOutput;
+    if(first <= last)
+    {
+        int count = (last-first)/D+1;
+        for(int done=0; done<count; done+=chunkOutputs)                     /// A chunk of input at a time
+        {
+            int outputs = std::min(chunkOutputs, count-done);
+            unsigned long long from = first+(unsigned long long)done*D;
+            if(!queue.peekAt(input, from-taps+1, (outputs-1)*D+taps))       /// From the oldest sample needed
+            {
+                valid = false;
+                return false;
+            }
+            for(int i=0; i<outputs; i++)
+            {
+                history[historyPos] = filtered(input+i*D, from+(unsigned long long)i*D);
+                historyPos = (historyPos+1)%zoomLen;
+            }
+        }
+        nextOutput = last+D;
+        valid = true;
+    }
+
+    /// Windowed FFT of the history in time order. Zoomed bin m is bin centreBin+m of the
+    /// full FFT (m negative at the top end, as usual).
+    FftPlan& plan = FftPlan::get(zoomLen);
+    cmplx* spectrum = plan.scratchBuffer();
+    const float* w = windowTable(window, zoomLen);
+    for(int i=0; i<zoomLen; i++)
+        spectrum[i] = history[(historyPos+i)%zoomLen]*(double)w[i];
+    plan.forward(spectrum, spectrum);
+    for(int k=k0; k<k1; k++)
+        magnitudeBuffer[k-k0] = spectrum[((k-centreBin)%zoomLen+zoomLen)%zoomLen];
+
+    /// A sinusoid of amplitude A gives A*n/2 in the n-point FFT, but A*(n/D)/2 here
+    runMagnitudes(dspKernels(), output+k0, magnitudeBuffer, k1-k0, vScale*D/windowGain(window));
+    return true;
+}
+
+size_t ZoomFFT::memoryUsage() const
+{
+    if(history == nullptr)
+        return 0;
+    return 2*taps*sizeof(double) + zoomLen*sizeof(cmplx) + ((chunkOutputs-1)*factor+taps)*sizeof(sample)
+           + (lastBin-firstBin)*sizeof(cmplx);
+}
+
+/**
+-----------------------
+----class Decimator----
+-----------------------
+Output sample m is the low-pass filtered input at queue position m*D, so outputs from
+different frames line up. The filter's cutoff is the decimated Nyquist frequency, and
+it is long enough (DECIMATION_FILTER_LENGTH*D taps) that everything folding down onto
+the lowest DECIMATION_PASSBAND of the decimated band is in the stopband.
+**/
+Decimator::Decimator()
+{
+    factor = taps = historyLen = 0;
+    filter = nullptr;
+    history = nullptr;
+    historyPos = 0;
+    input = nullptr;
+    chunkOutputs = 0;
+    nextOutput = 0;
+    valid = false;
+}
+Decimator::~Decimator()
+{
+    delete[] filter;
+    delete[] history;
+    delete[] input;
+}
+
+int Decimator::factorFor(int n, int topBin)
+{
+    const int factors[] = {16, 8, 4};
+    for(int D : factors)
+        if(n%D==0 && topBin <= DECIMATION_PASSBAND*(n/D/2))
+            return D;
+    return 1;
+}
+
+void Decimator::configure(int D, int count)
+{
+    delete[] filter;
+    delete[] history;
+    delete[] input;
+    factor = D;
+    taps = DECIMATION_FILTER_LENGTH*D;
+    historyLen = count;
+    filter = new double[taps];
+    designLowPass(filter, taps, 0.5/D);
+    history = new sample[count];
+    historyPos = 0;
+    chunkOutputs = std::max(ANALYSIS_CHUNK/D, 1);
+    input = new sample[(chunkOutputs-1)*D+taps];
+    valid = false;
+}
+
+bool Decimator::update(sample* output, AudioQueue& queue, unsigned long long end, int D, int count)
+{
+    if(D != factor || count != historyLen)
+        configure(D, count);
+
+    if(end < (unsigned long long)count*D+taps)
+        return false;
+    unsigned long long last = (end-1)/D*D;                                  /// Newest position to filter
+    unsigned long long first = last-(unsigned long long)(count-1)*D;
+    if(valid && nextOutput > last+D)                                        /// An older frame than last time
+        valid = false;
+    if(valid && nextOutput > first)                                         /// Only filter what is new since last time
+        first = nextOutput;
+    if(first <= last)
+    {
+        int newOutputs = (last-first)/D+1;
+        for(int done=0; done<newOutputs; done+=chunkOutputs)                /// A chunk of input at a time
+        {
+            int outputs = std::min(chunkOutputs, newOutputs-done);
+            unsigned long long from = first+(unsigned long long)done*D;
+            if(!queue.peekAt(input, from-taps+1, (outputs-1)*D+taps))
+            {
+                valid = false;
+                return false;
+            }
+            for(int i=0; i<outputs; i++)                                    /// Polyphase: only every Dth output is computed
+            {
+                const sample* newest = input+i*D+taps-1;
+                double y = 0;
+                for(int l=0; l<taps; l++)
+                    y += newest[-l]*filter[l];
+                y = std::max(-(double)MAX_SAMPLE_VALUE, std::min(y, (double)MAX_SAMPLE_VALUE));
+                history[historyPos] = (sample)round(y);
+                historyPos = (historyPos+1)%historyLen;
+            }
+        }
+        nextOutput = last+D;
+        valid = true;
+    }
+
+    for(int i=0; i<count; i++)                                              /// Oldest first, like peekFreshData()
+        output[i] = history[(historyPos+i)%historyLen];
+    return true;
+}
+
+size_t Decimator::memoryUsage() const
+{
+    if(history == nullptr)
+        return 0;
+    return taps*sizeof(double) + historyLen*sizeof(sample) + ((chunkOutputs-1)*factor+taps)*sizeof(sample);
+}
+
+/**
+-----------------------
+----class ConstantQ----
+-----------------------
+Q = 1/(2^(1/binsPerOctave)-1) makes neighbouring bins just touch. Bin k at frequency
+f_k needs a kernel of Q*RATE/f_k samples: Q cycles of f_k.
+**/
+ConstantQ::ConstantQ(double minFreq, double maxFreq, int binsPerOctave, int maxLength)
+{
+    this->minFreq = minFreq;
+    this->maxFreq = maxFreq;
+    binsPerOct = binsPerOctave;
+    maxLen = maxLength;
+    numBins = (int)floor(binsPerOctave*log2(maxFreq/minFreq))+1;
+    double Q = 1/(pow(2.0, 1.0/binsPerOctave)-1);
+    len = lengthFor(minFreq, binsPerOctave, maxLength);
+
+    cmplx* temporal = new cmplx[len];
+    kernelStart.push_back(0);
+    for(int k=0; k<numBins; k++)
+    {
+        double freq = frequency(k);
+        int kernelLen = std::min((int)ceil(Q*RATE/freq), len);
+        int offset = len-kernelLen;                                         /// Aligned to the end of the input
+        double windowSum = 0;
+        for(int i=0; i<len; i++)
+            temporal[i] = 0;
+        for(int i=0; i<kernelLen; i++)
+        {
+            double window = 0.5-0.5*cos(2*PI*(i+0.5)/kernelLen);           /// Hann
+            windowSum += window;
+            temporal[offset+i] = std::polar(window, 2*PI*freq*i/RATE);
+        }
+        for(int i=0; i<kernelLen; i++)
+            temporal[offset+i] /= windowSum;
+        fft(temporal, temporal, len);
+
+        double peak = 0;
+        for(int j=0; j<=len/2; j++)                                         /// Only positive frequencies, like the input spectrum
+            peak = std::max(peak, abs(temporal[j]));
+        for(int j=0; j<=len/2; j++)
+            if(abs(temporal[j]) >= CQT_THRESHOLD*peak)
+            {
+                kernelBin.push_back(j);
+                kernelValue.push_back(conj(temporal[j])/(double)len);
+            }
+        kernelStart.push_back(kernelBin.size());
+    }
+    delete[] temporal;
+}
+
+int ConstantQ::lengthFor(double minFreq, int binsPerOctave, int maxLength)
+{
+    double Q = 1/(pow(2.0, 1.0/binsPerOctave)-1);
+    int longest = std::min((int)ceil(Q*RATE/minFreq), maxLength);         /// The lowest bin has the longest kernel
+    int length = 1;
+    while(length < longest)
+        length *= 2;
+    return length;
+}
+
+bool ConstantQ::matches(double minFreq, double maxFreq, int binsPerOctave, int maxLength) const
+{
+    return minFreq==this->minFreq && maxFreq==this->maxFreq && binsPerOctave==binsPerOct && maxLength==maxLen;
+}
+
+void ConstantQ::transform(float* output, const sample* input)
+{
+    AudioView whole = {input, len, nullptr, 0};
+    transform(output, whole);
+}
+
+void ConstantQ::transform(float* output, const AudioView& input)
+{
+    FftPlan& plan = FftPlan::get(len);
+    cmplx* spectrum = plan.scratchBuffer();
+    plan.forwardReal(spectrum, input);
+    /// The input is real, so its negative frequencies mirror the positive ones and the
+    /// kernels (complex sinusoids) have next to nothing there. The positive half of the
+    /// inner product is the whole of it.
+    for(int k=0; k<numBins; k++)
+    {
+        double re = 0, im = 0;
+        for(int e=kernelStart[k]; e<kernelStart[k+1]; e++)
+        {
+            const cmplx& x = spectrum[kernelBin[e]];
+            const cmplx& w = kernelValue[e];
+            re += x.real()*w.real() - x.imag()*w.imag();
+            im += x.real()*w.imag() + x.imag()*w.real();
+        }
+        output[k] = sqrt(re*re+im*im);
+    }
+}
+
+size_t ConstantQ::memoryUsage() const
+{
+    return kernelStart.capacity()*sizeof(int) + kernelBin.capacity()*sizeof(int) + kernelValue.capacity()*sizeof(cmplx);
+}
+
+/**
+------------------
+----class STFT----
+------------------
+**/
+STFT::STFT()
+{
+    lastEnd = 0;
+    hopSize = getHopSize();
+    windowType = getAnalysisWindow();
+    frameCount = skippedCount = 0;
+}
+
+unsigned long long STFT::next(const AudioQueue& queue, int n)
+{
+    int hop = getHopSize();
+    unsigned long long end = queue.samplesPushed()/hop*hop;                 /// Newest completed frame
+    if(end < (unsigned long long)n || end <= lastEnd)
+        return 0;
+    if(lastEnd > 0 && hop == hopSize)
+        skippedCount += (end-lastEnd)/hop-1;
+    lastEnd = end;
+    hopSize = hop;
+    windowType = getAnalysisWindow();
+    frameCount++;
+    return end;
+}
+
+unsigned long long STFT::nextEnd(int n) const
+{
+    int hop = getHopSize();
+    unsigned long long first = ((unsigned long long)n+hop-1)/hop*hop;       /// The first frame must hold n samples
+    return std::max(first, (lastEnd/hop+1)*hop);
+}
+
+bool STFT::spectrum(sample* output, AudioQueue& queue, unsigned long long end, int n, float vScale)
+{
+    AudioView samples;
+    if(!queue.view(samples, end-n, n))
+        return false;
+    const float* w = windowType == RECTANGULAR_WINDOW ? nullptr : windowTable(windowType, n);
+    FindFrequencyContent(output, samples, w, n, vScale);                    /// Windowed inside the FFT, no copy
+    return queue.stillThere(end-n);
+}
+
+bool STFT::frame(sample* output, AudioQueue& queue, unsigned long long end, int n)
+{
+    AudioView samples;
+    if(!queue.view(samples, end-n, n))
+        return false;
+    if(windowType == RECTANGULAR_WINDOW)
+        samples.copyTo(output);
+    else
+    {
+        const float* w = windowTable(windowType, n);                        /// Windowed on the way out of the queue
+        const DSPKernels& kernels = dspKernels();
+        kernels.weight(output, samples.first, w, samples.firstLength);
+        kernels.weight(output+samples.firstLength, samples.second, w+samples.firstLength, samples.secondLength);
+    }
+    return queue.stillThere(end-n);
+}
@@ -1,17 +1,60 @@
 #include <iostream>
 #include <math.h>
 #include <complex>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <condition_variable>
+#include <chrono>
 
 #define RATE 44100                      /// Sample rate
 #define CHUNK 64                        /// Buffer size
 #define CHANNELS 1                      /// Mono audio
 #define FORMAT AUDIO_S16SYS             /// Sample format: signed system-endian 16 bit integers
 #define MAX_SAMPLE_VALUE 32767          /// Max sample value based on sample datatype
+#define PI 3.14159265358979323846       /// For FFT twiddle factors
 
-#define FFTLEN 65536                    /// Number of samples to perform FFT on. Must be power of 2.
+#define DEFAULT_FFTLEN 65536            /// Number of samples to perform FFT on, unless changed with setFFTLength().
+#define MIN_FFTLEN 16                   /// Limits for setFFTLength(). Any length in between works,
+#define MAX_FFTLEN 1048576              /// but powers of 2 are fastest.
+
+#define PARALLEL_FFT_THRESHOLD 16384    /// Power-of-2 complex FFTs at least this long may be split across the worker pool
+#define SPLIT_TRIALS 3                  /// Transforms timed each way before a plan decides whether to split
+#define SPLIT_MARGIN 0.9                /// The split must take less than this fraction of the serial time
+#define FOUR_STEP_BLOCK 8               /// Columns/rows moved at once by the four-step FFT
+
+#ifndef SINGLE_PRECISION_DEFAULT
+#define SINGLE_PRECISION_DEFAULT 1      /// Analyse in float unless changed with setSinglePrecision(). Build with -DSINGLE_PRECISION_DEFAULT=0 for double.
+#endif
 
 typedef short sample;                   /// Datatype of samples. Also used to store frequency coefficients.
 typedef std::complex<double> cmplx;     /// Complex number datatype for fft
+typedef std::complex<float> cmplxf;     /// Single-precision complex datatype
+
+/**
+------------------------
+----struct AudioView----
+------------------------
+A run of consecutive samples in an AudioQueue, read in place: the part up to the end
+of the ring and, if the run wraps around, the rest from the start of the ring.
+second is empty (and secondLength 0) when the run doesn't wrap.
+**/
+struct AudioView
+{
+    const sample* first;
+    int firstLength;
+    const sample* second;
+    int secondLength;
+
+    int length() const { return firstLength+secondLength; }
+    sample operator[](int i) const { return i<firstLength ? first[i] : second[i-firstLength]; }
+    void copyTo(sample* output) const;                                  /// All length() samples, in order
+};
 
 /**
 ------------------------
@@ -29,34 +72,712 @@ These things happen at unpredictable times since they are tied to audio sample r
 etc. rather than the clock speed.
 Reading and writing audio data from and to a queue helps prevent threading problems
 such as skipping/repeating samples or getting more or less data than expected.
+
+The queue is a lock-free broadcast ring buffer with one producer, the recording
+callback, and any number of readers. Each reader (class AudioReader: the playback
+callback, a recorder, an analyser...) has its own cursor, so none of them takes
+samples away from the others, and nobody ever waits for anybody.
+Capacity is rounded up to a power of 2 so positions map to audio[] with a mask.
+Positions are ever-increasing sample counts. push() publishes new samples by moving
+the back of the queue with a release store, and readers load it with acquire.
+Samples are copied with memcpy in at most two contiguous pieces. A volume other than 1
+goes through the gain kernel (see DSPKernels), which saturates instead of wrapping.
+
+push() never blocks and never fails: the oldest samples are simply overwritten.
+Readers that fall too far behind find out when they next read (an overrun) and skip
+ahead. Nothing is printed: the callbacks run on the audio thread and mustn't block or
+make system calls.
+
+Threads that only look at recent audio don't need a reader: peekAt() and
+peekFreshData() copy already-pushed samples and then check that the recording side
+hasn't overwritten them meanwhile.
+
+view() and freshView() give the same samples without copying them, as an AudioView
+into the ring. The recording side may overwrite them at any time, so after reading a
+view, check stillThere(position) before trusting what was read.
+
+readers() lists the registered readers, for statistics. Registering and listing take
+a lock, but push() and reading don't.
+
+waitFor() lets a thread that has caught up sleep until the sample before position has
+been pushed, or timeoutMs has passed, instead of polling. It returns whether the
+samples arrived. push() only wakes the condition variable if someone is waiting, so
+the audio thread makes no system call otherwise. It doesn't take the lock to do it, so
+a wake-up can slip in between a waiter's check and its wait; the timeout bounds that.
+
+resize() changes the capacity (rounded up to a power of 2 again), but only before
+anything has been pushed; it returns false otherwise. queueLengthFor() gives the
+capacity that analysis of n samples at a given hop needs.
 **/
+class AudioReader;
+
 class AudioQueue
 {
-    int len;                                                            /// Maximum length of queue
+    int len;                                                            /// Capacity (power of 2)
+    int mask;                                                           /// len-1
     sample *audio;                                                      /// Pointer to audio data array
-    int inpos;                                                          /// Index in audio[] of back of queue
-    int outpos;                                                         /// Index in audio[] of front of queue
+    std::atomic<unsigned long long> pushed;                             /// Total number of samples ever pushed (back of queue)
+    mutable std::mutex readerLock;                                      /// Guards readerList
+    std::vector<AudioReader*> readerList;
+    std::mutex waitLock;                                                /// For newAudio
+    std::condition_variable newAudio;                                   /// Notified by push() when waiters > 0
+    std::atomic<int> waiters;                                           /// Threads in waitFor()
+
+    void copyOut(sample* output, unsigned long long position, int n_samples, float volume) const;
+    friend class AudioReader;
   public:
-    AudioQueue(int QueueLength = 10000);                                /// Constructor. Takes maximum length.
+    AudioQueue(int QueueLength = 10000);                                /// Constructor. Takes maximum length (rounded up to a power of 2).
     ~AudioQueue();
-    bool data_available(int n_samples = 1);                             /// Check if the queue has n_samples of data in it.
-    bool space_available(int n_samples = 1);                            /// Check if the queue has space for n_samples of new data.
-    void push(sample* input, int n_samples, float volume=1);            /// Push n_samples of new data to the queue
-    void pop(sample* output, int n_samples, float volume=1);            /// Pop n_samples of data from the queue
-    void peek(sample* output, int n_samples, float volume=1);           /// Peek the n_samples that would be popped
-    void peekFreshData(sample* output, int n_samples, float volume=1);  /// Peek the freshest n_samples (for instantly reactive FFT)
+    int capacity() const { return len; }
+    bool resize(int QueueLength);                                       /// New capacity, before the first push() only
+    size_t memoryUsage() const { return len*sizeof(sample); }           /// Bytes of audio storage
+    void push(sample* input, int n_samples, float volume=1);            /// Push n_samples of new data to the queue (recording thread only)
+    bool peekFreshData(sample* output, int n_samples, float volume=1);  /// Peek the freshest n_samples (for instantly reactive FFT)
+
+    /// Every pushed sample has a position: the number of samples pushed before it.
+    unsigned long long samplesPushed() const { return pushed.load(std::memory_order_acquire); } /// Position of the next sample to be pushed
+    bool peekAt(sample* output, unsigned long long position,            /// Copy n_samples starting at position. False if they haven't
+                int n_samples);                                         /// been pushed yet or have (nearly) been overwritten.
+    bool view(AudioView& output, unsigned long long position,           /// The same n_samples, in place
+              int n_samples) const;
+    bool freshView(AudioView& output, int n_samples) const;             /// The freshest n_samples, in place
+    bool stillThere(unsigned long long position) const;                 /// Whether the sample at position hasn't (nearly) been overwritten
+    bool waitFor(unsigned long long position, int timeoutMs);           /// Sleep until position samples have been pushed. False on timeout.
+
+    std::vector<const AudioReader*> readers() const;                    /// Registered readers (not for the audio thread)
+};
+
+/**
+-------------------------
+----class AudioReader----
+-------------------------
+One consumer of an AudioQueue, with its own cursor. Registers itself with the queue
+on construction and unregisters on destruction. Starts reading at the newest sample,
+or if fromStart is set, as far back as the queue reliably holds (half its capacity).
+
+read() copies the next n_samples and moves the cursor past them, like popping. If
+fewer are available, the rest of output is silence (an underrun). view() and
+advance() do the same without copying: read the view, then advance() past it, which
+returns false if the samples were overwritten meanwhile.
+
+A reader more than three quarters of the queue behind the newest sample has been
+overrun: its samples may be overwritten at any moment. It skips ahead to half a queue
+behind, and the skipped samples are counted.
+
+Only one thread may read from a given reader. The statistics can be read from any.
+**/
+class AudioReader
+{
+    AudioQueue& queue;
+    const char* readerName;
+    std::atomic<unsigned long long> position;                           /// Next sample to read
+    std::atomic<unsigned long long> samplesRead;
+    std::atomic<unsigned long long> overruns;                           /// Samples skipped because they were overwritten
+    std::atomic<unsigned long long> underruns;                          /// Samples of silence made up for missing audio
+    std::atomic<unsigned long long> maxLag;                             /// Largest lag seen at a read
+
+    unsigned long long catchUp();                                       /// Skips ahead if overrun. Returns the position to read from.
+    AudioReader(const AudioReader&);                                    /// Not copyable
+    AudioReader& operator=(const AudioReader&);
+  public:
+    AudioReader(AudioQueue& queue, const char* name, bool fromStart = false);
+    ~AudioReader();
+    const char* name() const { return readerName; }
+    void read(sample* output, int n_samples, float volume=1);
+    bool view(AudioView& output, int n_samples);                        /// Up to n_samples, in place. False if none available.
+    bool advance(int n_samples);
+
+    unsigned long long lag() const;                                     /// Samples pushed but not read yet
+    unsigned long long maximumLag() const { return maxLag; }
+    unsigned long long totalRead() const { return samplesRead; }
+    unsigned long long overrunCount() const { return overruns; }
+    unsigned long long underrunCount() const { return underruns; }
+};
+
+/**
+-------------------------
+----class TripleBuffer----
+-------------------------
+Hands whole objects (analysis results, say) from one producer thread to one consumer
+thread without either ever waiting for the other. Of the three buffers, the producer
+owns one (writeBuffer()), the consumer owns another (readBuffer()), and the third sits
+in the middle, swapped atomically with either side.
+
+publish() swaps the finished write buffer into the middle, marked fresh. update() swaps
+a fresh middle buffer in as the read buffer and returns true, or returns false if
+nothing has been published since the last update(). A consumer that falls behind
+simply gets the newest object; the ones in between are overwritten unseen.
+**/
+template<typename T>
+class TripleBuffer
+{
+    T buffers[3];
+    std::atomic<int> middle;                                            /// Index of the middle buffer, plus FRESH if not yet read
+    int back;                                                           /// Producer's buffer
+    int front;                                                          /// Consumer's buffer
+    static const int FRESH = 4;
+
+    TripleBuffer(const TripleBuffer&);                                  /// Not copyable
+    TripleBuffer& operator=(const TripleBuffer&);
+  public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+    T& writeBuffer() { return buffers[back]; }                          /// Producer only
+    void publish() { back = middle.exchange(back|FRESH, std::memory_order_acq_rel)&~FRESH; }
+    bool update()                                                       /// Consumer only
+    {
+        if(!(middle.load(std::memory_order_relaxed)&FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel)&~FRESH;
+        return true;
+    }
+    const T& readBuffer() const { return buffers[front]; }              /// Consumer only
+    bool fresh() const { return middle.load(std::memory_order_acquire)&FRESH; }    /// Whether update() would return true
+    const T& buffer(int i) const { return buffers[i]; }                 /// Any of the three, once neither thread uses them
 };
 
 void dftmag(sample* output, sample* input, int n);                      /// O(n^2) DFT. Not actually used.
 
-void fft(cmplx* output, cmplx* input, int n);                           /// Simplest FFT algorithm
+/**
+------------------------
+----class WorkerPool----
+------------------------
+A fixed set of threads for splitting DSP work across cores. The pool is created once,
+on first use, with one thread per hardware thread (or the number given to
+setThreads() beforehand); the calling thread counts as one of them.
+
+parallelFor(count, f) calls f(begin, end) on disjoint sub-ranges covering [0, count),
+spread over all threads, and returns when they are all done. Calls from inside a task
+run serially.
+
+get() only takes a lock while the pool is being created, so it is cheap enough to
+call per transform. setThreads() must not be called while another thread is using
+the pool.
+**/
+class WorkerPool
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;                                                   /// Guards everything below
+    std::mutex jobLock;                                                 /// One parallelFor() at a time
+    std::condition_variable wake;                                       /// Workers wait here for a job
+    std::condition_variable finished;                                   /// parallelFor() waits here for the workers
+    bool stopping;
+    unsigned long long generation;                                      /// Incremented for every job
+    int busyWorkers;                                                    /// Workers not yet done with the current job
+    const std::function<void(int, int)>* task;
+    int taskCount;
+    int chunkSize;
+    std::atomic<int> nextIndex;                                         /// Start of the next unclaimed chunk
+
+    WorkerPool(int numThreads);
+    void workerLoop();
+    void runChunks();
+  public:
+    ~WorkerPool();
+    static WorkerPool& get();                                           /// The process-wide pool
+    static void setThreads(int numThreads);                             /// Pool size (0 = hardware threads). Rebuilds the pool if it changes.
+    static int requestedThreads();                                      /// The last setThreads() value (0 if never called)
+    int threads() const { return workers.size()+1; }
+    void parallelFor(int count, const std::function<void(int, int)>& f);
+};
+
+/**
+--------------------------
+----class BasicFftPlan----
+--------------------------
+Everything needed to perform FFTs of one particular length: twiddle factors,
+bit-reversal table and scratch space. Building a plan is expensive, so plans are
+created once and kept in a process-wide cache; get(n) returns the cached plan for
+length n, creating it on first use.
+
+Powers of 2 use the iterative radix-2 algorithm. Any other length uses Bluestein's
+algorithm on top of a power-of-2 plan, so every length is supported. For 4096, 8192,
+16384 and 65536 the double-precision butterfly stages come from compile-time
+specialized templates. Single precision (the analysis default) always uses the
+SIMD kernel stages, which are faster than the specialized double stages anyway.
+
+Power-of-2 lengths of at least PARALLEL_FFT_THRESHOLD can be done with the four-step
+algorithm, split across the WorkerPool. Whether that pays depends on the machine, so
+by default each such plan times SPLIT_TRIALS transforms each way on its first call
+(with a pool of more than one thread) and only splits from then on if the four-step
+FFT took under SPLIT_MARGIN of the time. That makes the threshold automatic: lengths
+too short to gain from the threads stay serial. --threads=N (WorkerPool::setThreads())
+skips the timing: N > 1 always splits, N = 1 never does. The four-step buffer is
+freed again if the plan decides not to split.
+
+Real is the floating point type used throughout: FftPlan is double precision and
+FftPlanF is single precision (half the memory traffic, plenty for 16-bit input).
+
+forward():       n-point complex FFT. output and input may be the same array.
+forwardReal():   FFT of n real samples. Writes the n/2+1 non-redundant bins (DC to
+                 Nyquist). Even lengths are done with an n/2-point complex FFT.
+                 The samples can also come straight from an AudioView, optionally
+                 multiplied by an n-point window table on the way in.
+scratchBuffer(): n complex values of scratch space. Shared by all users of the plan,
+                 so not to be used by two threads at once.
+memoryUsage():   Bytes allocated by this plan (not counting the plans it uses).
+                 cacheMemory() is the total over all cached plans.
+**/
+template<typename Real>
+class BasicFftPlan
+{
+    typedef std::complex<Real> complex_t;
+
+    int len;                                                            /// Transform length
+    bool pow2;                                                          /// Whether len is a power of 2
+    complex_t* twiddles;                                                /// Stage-major twiddle factors (power-of-2 lengths)
+    int* bitrev;                                                        /// Bit-reversal permutation (power-of-2 lengths)
+    complex_t* realTwiddles;                                            /// exp(-2*pi*i*k/n) for k < n/2 (even lengths)
+    BasicFftPlan* halfPlan;                                             /// Plan for n/2, used by forwardReal() (even lengths)
+    int convLen;                                                        /// Bluestein convolution length (non-power-of-2 lengths)
+    complex_t* chirp;                                                   /// Bluestein chirp exp(-pi*i*j^2/n)
+    complex_t* chirpFilter;                                             /// FFT of the zero-padded conj(chirp) filter
+    complex_t* convScratch;                                             /// Bluestein convolution buffer
+    BasicFftPlan* convPlan;                                             /// Power-of-2 plan of length convLen
+    complex_t* scratch;                                                 /// Scratch space for callers
+    int rows, cols;                                                     /// Four-step split, n = rows*cols (large power-of-2 lengths)
+    BasicFftPlan* columnPlan;                                           /// Plan for rows (length of a column)
+    BasicFftPlan* rowPlan;                                              /// Plan for cols (length of a row)
+    complex_t* fourStepBuffer;                                          /// Intermediate matrix (allocated on first use)
+    int splitMeasured;                                                  /// Four-step timed faster (1), not faster (-1), or not yet (0)
+
+    void forwardParallel(complex_t* output, const complex_t* input);    /// Four-step FFT on the worker pool
+    bool splitPays(const complex_t* input);                             /// Whether forward() should use forwardParallel()
+    bool parallelIsFaster(const complex_t* input);                      /// Times both ways on input
+
+    static std::map<int, BasicFftPlan*>& cache();
+    static std::recursive_mutex& cacheLock();
+    BasicFftPlan(int n);                                                /// Use get() instead
+    BasicFftPlan(const BasicFftPlan&);                                  /// Not copyable
+    BasicFftPlan& operator=(const BasicFftPlan&);
+  public:
+    ~BasicFftPlan();
+    static BasicFftPlan& get(int n);                                    /// Cached plan for length n
+    int length() const { return len; }
+    void forward(complex_t* output, const complex_t* input);            /// Complex FFT
+    void forwardReal(complex_t* output, const sample* input);           /// Real-input FFT, n/2+1 bins
+    void forwardReal(complex_t* output, const AudioView& input, const float* window = nullptr);
+    complex_t* scratchBuffer() { return scratch; }
+    size_t memoryUsage() const;
+    static size_t cacheMemory();
+
+    static bool useFixedSize;                                           /// Use specialized stages when available (default true)
+};
+
+typedef BasicFftPlan<double> FftPlan;
+typedef BasicFftPlan<float> FftPlanF;
+
+/**
+----fft()----
+n-point complex FFT using the cached plan for n. output and input may point to the
+same array, in which case the transform is done in-place.
+**/
+void fft(cmplx* output, cmplx* input, int n);
+
+/**
+----rfft()----
+FFT of n real samples via an n/2-point complex FFT. Writes the n/2+1 non-redundant
+bins (DC to Nyquist) to output, which must have room for them.
+**/
+void rfft(cmplx* output, sample* input, int n);
+
+/**
+----FFT length----
+The number of samples analysed by the visualizers. Starts at DEFAULT_FFTLEN.
+setFFTLength() returns false (and changes nothing) if n is outside
+[MIN_FFTLEN, MAX_FFTLEN].
+**/
+int getFFTLength();
+bool setFFTLength(int n);
+
+/**
+----Analysis precision----
+Whether FindFrequencyContent() computes in float (true) or double (false). Starts at
+SINGLE_PRECISION_DEFAULT. The output is the same either way; double is kept for
+validating the float path.
+**/
+bool getSinglePrecision();
+void setSinglePrecision(bool enable);
+
+/**
+----Analysis window----
+Window applied to each STFT frame (see class STFT). All are cosine sums,
+    w[i] = a0 - a1*cos(2*pi*i/n) + a2*cos(4*pi*i/n) - a3*cos(6*pi*i/n)
+taken periodically (DFT-even), so a window can equally be applied to DFT bins as a
+convolution with 2*windowTerms()+1 taps. Starts at HANN_WINDOW.
+
+windowTable() is the cached n-point table. windowGain() is the window's mean, a0:
+a windowed sinusoid peaks that much lower, so windowed analyses divide by it.
+applyWindow() multiplies n samples by the n-point table, in place.
+windowTableMemory() is the number of bytes held by all cached tables.
+**/
+enum WindowType { RECTANGULAR_WINDOW, HANN_WINDOW, BLACKMAN_HARRIS_WINDOW };
+
+WindowType getAnalysisWindow();
+void setAnalysisWindow(WindowType window);
+bool setAnalysisWindow(const char* name);                               /// "rectangular", "hann" or "blackman-harris". False if unknown.
+const char* windowName(WindowType window);
+const double* windowCoefficients(WindowType window);                    /// a0 to a3
+int windowTerms(WindowType window);                                     /// Highest non-zero term: 0, 1 or 3
+double windowGain(WindowType window);
+const float* windowTable(WindowType window, int n);
+size_t windowTableMemory();
+void applyWindow(sample* data, int n, WindowType window);
+
+/**
+----Hop size----
+Samples between the ends of consecutive STFT frames. Starts at DEFAULT_HOP.
+setHopSize() returns false (and changes nothing) if n is outside [1, MAX_FFTLEN].
+**/
+#define DEFAULT_HOP 512                 /// About 11.6ms at RATE, close to the display refresh time
+
+int getHopSize();
+bool setHopSize(int n);
+
+/**
+----queueLengthFor()----
+Smallest AudioQueue capacity that analysis of n-sample frames, a hop apart, can work
+from. The analysers reach back at most 2n samples from the end of a frame (ZoomFFT's
+filter adds up to n to the frame), frames end up to a hop before the newest sample, and
+readers only trust the newest three quarters of the queue. Rounded up to a power of 2.
+**/
+int queueLengthFor(int n, int hop);
+
+/**
+----DSP kernels----
+Inner loops of the FFT, of FindFrequencyContent() and of sample conversion, in scalar,
+SSE2 and AVX2/FMA versions. The fastest version supported by the CPU is picked the first time
+dspKernels() is called, so one binary runs on old and new x86 machines alike.
+Each kernel has a double and a single-precision (F) version. avx2 tells other code
+compiled for AVX2/FMA (the fixed-size FFT stages) that it may run too.
+
+fftStage:   one butterfly stage of fft(), merging pairs of length-m transforms using
+            the m twiddle factors in w.
+magnitudes: output[i] = min(abs(input[i])*scale, MAX_SAMPLE_VALUE)
+widen:      Converts samples to floating point.
+slideBins:  Sliding DFT update (see SlidingDFT). For each of the count deltas in turn,
+            bins[k] = (bins[k] + delta)*rotation[k] for all numBins bins.
+goertzel:   Goertzel recurrence over n samples for each of numBins bins, given
+            coeff[k] = 2cos(2*pi*bin/n). Writes the squared magnitude of each bin.
+gain:       output[i] = input[i]*gain, rounded to the nearest sample value and clamped
+            to the sample range. output may be the same array as input.
+weight:     The same with a gain per sample, weights[i] (windowing).
+interleave: output[2i] = left[i], output[2i+1] = right[i], for n sample pairs.
+            deinterleave does the reverse.
+**/
+struct DSPKernels
+{
+    const char* name;
+    bool avx2;                                                          /// CPU has AVX2 and FMA
+    void (*fftStage)(cmplx* data, int n, const cmplx* w, int m);
+    void (*magnitudes)(sample* output, const cmplx* input, int n, double scale);
+    void (*widen)(double* output, const sample* input, int n);
+    void (*fftStageF)(cmplxf* data, int n, const cmplxf* w, int m);
+    void (*magnitudesF)(sample* output, const cmplxf* input, int n, float scale);
+    void (*widenF)(float* output, const sample* input, int n);
+    void (*slideBins)(cmplx* bins, const cmplx* rotation, int numBins, const double* delta, int count);
+    void (*goertzel)(double* power, const double* coeff, int numBins, const double* input, int n);
+    void (*gain)(sample* output, const sample* input, int n, float gain);
+    void (*weight)(sample* output, const sample* input, const float* weights, int n);
+    void (*interleave)(sample* output, const sample* left, const sample* right, int n);
+    void (*deinterleave)(sample* left, sample* right, const sample* input, int n);
+};
+
+const DSPKernels& dspKernels();                                         /// Kernels selected for this CPU
+bool setDSPKernels(const char* name);                                   /// Force a kernel set by name (if CPU supports it)
 
 /**
 ----FindFrequencyContent()----
 Takes pointer to an array of audio samples, performs FFT, and outputs magnitude of
 complex coefficients.
 i.e., it give amplitude but not phase of frequency components in given audio.
+Only the n/2+1 non-redundant bins are written to output.
+The samples can also be read straight out of an AudioQueue, multiplied by an n-point
+window table (nullptr for none) as they go into the FFT.
 **/
 void FindFrequencyContent(sample* output, sample* input, int n, float vScale = 0.005);
+void FindFrequencyContent(sample* output, const AudioView& input, const float* window, int n, float vScale = 0.005);
+
+/**
+----Goertzel filter bank----
+GoertzelContent() computes just the listed DFT bins of n samples, each directly from
+the samples with the Goertzel recurrence, and writes their magnitudes to
+output[bins[i]] with the same scaling as FindFrequencyContent(). Costs about
+n*numBins operations (split across the WorkerPool), against n*log2(n) for the FFT, so
+it only pays off for a few dozen bins per thread.
+
+FindBinContent() writes at least the listed bins of output (which must have room for
+n/2+1), using the Goertzel bank when goertzelIsFaster() and FindFrequencyContent()
+otherwise.
+**/
+void GoertzelContent(sample* output, const sample* input, int n, const int* bins, int numBins, float vScale = 0.005);
+bool goertzelIsFaster(int n, int numBins);
+void FindBinContent(sample* output, sample* input, int n, const int* bins, int numBins, float vScale = 0.005);
+
+/**
+----CheckSinglePrecision()----
+Accuracy check of the single-precision path against the double-precision one, on the
+given n samples. relativeError is the largest complex error of any bin, relative to
+the largest bin. maxMagnitudeDifference is the largest difference between the two
+FindFrequencyContent() outputs (in output units, with the given vScale).
+**/
+struct PrecisionReport
+{
+    double relativeError;
+    int maxMagnitudeDifference;
+};
+
+PrecisionReport CheckSinglePrecision(sample* input, int n, float vScale = 0.005);
+
+/**
+------------------------
+----class SlidingDFT----
+------------------------
+Keeps bins [firstBin, lastBin) of the DFT of the freshest n samples in an AudioQueue up
+to date from frame to frame, instead of transforming all n samples every time. Each new
+sample slides the window along by one, which changes bin k by
+    X[k] <- (X[k] + newest sample - oldest sample)*exp(2*pi*i*k/n)
+so a frame costs (new samples)*(bins) complex multiplies. Narrow bands between
+frames a few milliseconds apart are much cheaper this way than a full FFT.
+
+The bins are instead recomputed with an FFT when that would be cheaper (long gap
+between frames or a wide band), when n or the band changes, and every
+SDFT_RESYNC_SAMPLES samples so that rounding errors can't build up.
+
+update() analyses the n samples before queue position end (queue.samplesPushed() for
+the freshest audio). It writes the magnitudes of bins [firstBin, lastBin) to the same
+elements of output that FindFrequencyContent() would, with the same scaling; the rest of
+output is left alone. Returns false, writing nothing, if the queue doesn't hold those
+samples.
+
+With a window other than RECTANGULAR_WINDOW, windowTerms() extra bins are kept on
+either side of the band and the window is applied to the bins by convolution.
+Magnitudes are divided by windowGain(), so peaks stay the same height.
+
+New samples are slid in ANALYSIS_CHUNK at a time, so memory doesn't grow with n.
+memoryUsage() is the number of bytes allocated, here and in the classes below.
+**/
+#define SDFT_RESYNC_SAMPLES (4*RATE)    /// Recompute the sliding DFT from scratch at least this often
+#define ANALYSIS_CHUNK 4096             /// Most samples SlidingDFT, ZoomFFT and Decimator copy out of the queue at once
+
+class SlidingDFT
+{
+    int len;                                                            /// Window length n
+    int firstBin, lastBin;                                              /// Bins kept up to date: the band, plus windowTerms() either side
+    int bandFirst, bandLast;                                            /// Bins asked for
+    WindowType window;
+    cmplx* bins;                                                        /// DFT bins firstBin..lastBin-1
+    cmplx* windowed;                                                    /// Windowed bins bandFirst..bandLast-1
+    cmplx* rotation;                                                    /// exp(2*pi*i*k/n) for the same bins
+    sample* incoming;                                                   /// Samples entering the window (ANALYSIS_CHUNK of them)
+    sample* outgoing;                                                   /// Samples leaving the window (as many)
+    double* delta;                                                      /// incoming - outgoing
+    unsigned long long position;                                        /// Queue position just past the newest sample in the window
+    unsigned long long lastResync;                                      /// Value of position at the last recompute
+    bool valid;                                                         /// Whether bins[] hold anything yet
+    unsigned long long slidingUpdates, fullUpdates;
 
+    void configure(int n, int k0, int k1, WindowType w);
+    bool recompute(AudioQueue& queue, unsigned long long end);
+    bool slide(AudioQueue& queue, unsigned long long end);
+    cmplx bin(int k) const;                                             /// Any bin within windowTerms() of the band, by symmetry if need be
+  public:
+    SlidingDFT();
+    ~SlidingDFT();
+    bool update(sample* output, AudioQueue& queue, unsigned long long end, int n, int firstBin, int lastBin,
+                WindowType window = RECTANGULAR_WINDOW, float vScale = 0.005);
+    unsigned long long slidingUpdateCount() const { return slidingUpdates; }    /// Frames done by sliding
+    unsigned long long fullUpdateCount() const { return fullUpdates; }          /// Frames done by recomputing
+    size_t memoryUsage() const;
+};
 
+/**
+---------------------
+----class ZoomFFT----
+---------------------
+Bins [firstBin, lastBin) of the n-point DFT of the freshest audio, for a narrow band,
+from a much shorter FFT. The band is shifted down to 0Hz, low-pass filtered and
+decimated by a power of 2, D, leaving n/D complex samples whose FFT has the same bin
+spacing as the n-point one. So resolution is the same, but the FFT is D times shorter.
+
+Shifting and filtering are done in one step, with a complex band-pass filter (the
+low-pass filter shifted up to the band), evaluated only at every Dth sample. Like
+SlidingDFT, filtered samples are kept from frame to frame, so each frame only filters
+the audio that arrived since the last one. The filter delays the output by
+ZOOM_FILTER_LENGTH*D/2 samples.
+
+decimationFor() gives the D that update() would use for a band, or 1 if the band is
+too wide or too close to 0Hz or Nyquist for zooming to work. D is kept small enough
+that the filter is no longer than n.
+
+update() analyses the n samples before queue position end, applying the window to the
+decimated samples. It writes the magnitudes of bins [firstBin, lastBin) to the same
+elements of output as FindFrequencyContent() would, with the same scaling (divided by
+windowGain()). Returns false if the band can't be zoomed or the queue doesn't hold
+enough audio.
+**/
+#define ZOOM_FILTER_LENGTH 12           /// Low-pass filter taps per unit of decimation
+#define MIN_ZOOM_DECIMATION 4           /// Don't bother zooming by less than this
+
+class ZoomFFT
+{
+    int len;                                                            /// n
+    int firstBin, lastBin;
+    int centreBin;                                                      /// Bin shifted down to 0Hz
+    int factor;                                                         /// Decimation D
+    int zoomLen;                                                        /// n/D, the zoomed FFT length
+    int taps;                                                           /// Filter length
+    double* filterRe;                                                   /// Band-pass filter, real and imaginary parts
+    double* filterIm;
+    cmplx* history;                                                     /// Last n/D filtered, shifted samples (circular)
+    int historyPos;                                                     /// Oldest sample in history[]
+    sample* input;                                                      /// Audio being filtered (one chunk)
+    int chunkOutputs;                                                   /// Filtered samples per chunk of input
+    cmplx* magnitudeBuffer;                                             /// Zoomed bins in band order
+    unsigned long long nextOutput;                                      /// Queue position of the next filtered sample
+    bool valid;
+
+    void configure(int n, int k0, int k1, int D);
+    cmplx filtered(const sample* x, unsigned long long position);       /// Filter output at position; x[0] is at position-taps+1
+  public:
+    ZoomFFT();
+    ~ZoomFFT();
+    static int decimationFor(int n, int firstBin, int lastBin);
+    bool update(sample* output, AudioQueue& queue, unsigned long long end, int n, int firstBin, int lastBin,
+                WindowType window = RECTANGULAR_WINDOW, float vScale = 0.005);
+    size_t memoryUsage() const;
+};
+
+/**
+-----------------------
+----class Decimator----
+-----------------------
+Anti-alias filters and decimates the audio in an AudioQueue by D (4, 8 or 16), for
+analysis that only needs low frequencies. An n/D-point FFT of the decimated audio has
+exactly the same bins as an n-point FFT of the original, up to the decimated Nyquist
+frequency (bin n/(2D)), for D times less work. Scale magnitudes up by D to match.
+The window still spans the same n samples of time, as it must for the same
+resolution, and the filter adds DECIMATION_FILTER_LENGTH*D/2 samples of delay.
+
+Only the lowest DECIMATION_PASSBAND of the decimated bins are free of filter roll-off
+and aliasing. factorFor() gives the largest D that keeps bins up to topBin of an
+n-point FFT in there, or 1 if even D = 4 doesn't.
+
+update() writes the count decimated samples before queue position end, oldest first,
+like AudioQueue::peekFreshData(). Like SlidingDFT, it keeps the filtered samples from
+frame to frame and only filters new audio. Returns false if the queue doesn't hold
+enough audio.
+**/
+#define DECIMATION_FILTER_LENGTH 28     /// Anti-alias filter taps per unit of decimation
+#define DECIMATION_PASSBAND 0.8         /// Usable fraction of the decimated band
+
+class Decimator
+{
+    int factor;                                                         /// D
+    int taps;
+    double* filter;                                                     /// Low-pass filter
+    sample* history;                                                    /// Last historyLen decimated samples (circular)
+    int historyLen;
+    int historyPos;                                                     /// Oldest sample in history[]
+    sample* input;                                                      /// Audio being filtered (one chunk)
+    int chunkOutputs;                                                   /// Decimated samples per chunk of input
+    unsigned long long nextOutput;                                      /// Queue position of the next decimated sample
+    bool valid;
+
+    void configure(int D, int count);
+  public:
+    Decimator();
+    ~Decimator();
+    static int factorFor(int n, int topBin);
+    bool update(sample* output, AudioQueue& queue, unsigned long long end, int D, int count);
+    size_t memoryUsage() const;
+};
+
+/**
+-----------------------
+----class ConstantQ----
+-----------------------
+Constant-Q transform: binsPerOctave bins per octave from minFreq up to maxFreq (Hz),
+each with a bandwidth proportional to its frequency, so a log-frequency display gets
+the same resolution everywhere instead of a linear FFT squashed onto a log axis.
+
+Uses the method of Brown and Puckette: bin k is the inner product of the input with a
+Hann-windowed complex sinusoid of Q cycles, which equals an inner product of their
+spectra. The spectra of these kernels are computed once, in the constructor, and
+stored sparsely (only the few FFT bins around each kernel's frequency matter), so a
+transform is one real FFT plus a short sum per bin.
+
+Kernels longer than maxLength samples are cut down to maxLength, lowering Q for the
+lowest bins. length() is the number of samples transformed: the smallest power of 2
+that holds the longest kernel. All kernels end at the last sample, so every bin looks
+at the freshest audio.
+
+transform() takes length() samples, from an array or in place from an AudioView, and
+writes bins() magnitudes. A sinusoid of amplitude A gives A/2 in its bin, whatever the
+kernel length.
+**/
+#define CQT_THRESHOLD 0.005             /// Kernel spectrum values below this fraction of the peak are dropped
+
+class ConstantQ
+{
+    double minFreq, maxFreq;                                            /// As passed to the constructor
+    int binsPerOct;
+    int maxLen;
+    int numBins;
+    int len;                                                            /// Samples per transform (power of 2)
+    std::vector<int> kernelStart;                                       /// Kernel k is entries kernelStart[k] to kernelStart[k+1]-1
+    std::vector<int> kernelBin;                                         /// FFT bin of each entry
+    std::vector<cmplx> kernelValue;                                     /// conj(kernel spectrum)/length()
+  public:
+    ConstantQ(double minFreq, double maxFreq, int binsPerOctave, int maxLength = MAX_FFTLEN);
+    static int lengthFor(double minFreq, int binsPerOctave, int maxLength = MAX_FFTLEN);    /// length() without building the kernels
+    bool matches(double minFreq, double maxFreq, int binsPerOctave, int maxLength) const;
+    int length() const { return len; }
+    int bins() const { return numBins; }
+    int binsPerOctave() const { return binsPerOct; }
+    double frequency(int k) const { return minFreq*pow(2.0, (double)k/binsPerOct); }
+    int kernelSize() const { return kernelValue.size(); }               /// Stored kernel entries, over all bins
+    void transform(float* output, const sample* input);
+    void transform(float* output, const AudioView& input);
+    size_t memoryUsage() const;                                         /// Bytes held by the kernels
+};
+
+/**
+------------------
+----class STFT----
+------------------
+Schedules the frames of a short-time Fourier transform of the audio in an AudioQueue.
+Frames end at queue positions that are multiples of the hop size, so consecutive frames
+overlap by exactly n-hop samples and analysis costs RATE/hop transforms per second
+however often the display asks for one.
+
+next() returns the end position of the newest frame completed since the last call, or 0
+if there is none yet (or the queue doesn't hold n samples). The hop size and window
+are read from getHopSize() and getAnalysisWindow() at that point and kept for the
+frame. A caller that falls more than a hop behind gets the newest frame; the ones in
+between are skipped, and counted, since only the freshest is ever displayed.
+
+nextEnd() is the queue position at which the frame after the last one handed out will
+be complete, so a caller with nothing to do can waitFor() it.
+
+frame() copies the n samples of the frame ending at end, applying the window on the
+way. FindFrequencyContent() magnitudes of a frame are windowGain() lower than unwindowed.
+spectrum() is FindFrequencyContent() of the same frame without the copy: the FFT reads
+the queue in place and applies the window as it widens the samples.
+**/
+class STFT
+{
+    unsigned long long lastEnd;                                         /// End of the last frame handed out
+    int hopSize;
+    WindowType windowType;
+    unsigned long long frameCount, skippedCount;
+  public:
+    STFT();
+    unsigned long long next(const AudioQueue& queue, int n);
+    unsigned long long nextEnd(int n) const;
+    bool frame(sample* output, AudioQueue& queue, unsigned long long end, int n);
+    bool spectrum(sample* output, AudioQueue& queue, unsigned long long end, int n, float vScale = 0.005);
+    int hop() const { return hopSize; }                                 /// Hop size of the last frame
+    WindowType window() const { return windowType; }                    /// Window of the last frame
+    unsigned long long frames() const { return frameCount; }            /// Frames handed out
+    unsigned long long skippedFrames() const { return skippedCount; }   /// Frames passed over
+};
@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <chrono>
+#include "helper.h"
+#include "benchmark.h"
+
+/// Average time per call of f() in microseconds. Repeats f() for at least minMilliseconds.
+template<typename F>
+static double timeMicroseconds(F f, double minMilliseconds = 200)
+{
+    typedef std::chrono::steady_clock clock;
+    f();                                                                    /// Warm-up (plans, caches)
+    int calls = 0;
+    clock::time_point start = clock::now();
+    double elapsed = 0;
+    do
+    {
+        f();
+        calls++;
+        elapsed = std::chrono::duration<double, std::micro>(clock::now()-start).count();
+    } while(elapsed < minMilliseconds*1000);
+    return elapsed/calls;
+}
+
+/// Fills buffer with a few sines plus a sawtooth, roughly like real microphone input.
+static void makeTestSignal(sample* buffer, int n)
+{
+    for(int i=0; i<n; i++)
+        buffer[i] = (sample)(6000*sin(2*PI*i*0.013) + 3000*sin(2*PI*i*0.071) + (i*37)%2001 - 1000);
+}
+
+/**
+----Fixed-size vs generic FFT----
+Complex FFT time per transform, for the lengths with compile-time specialized stages.
+The last column is the single-precision plan (generic stages only), which is what
+the analysis uses by default.
+**/
+static void BenchmarkFixedSizeFFT()
+{
+    std::cout<<"\nFixed-size vs generic FFT ("<<dspKernels().name<<" kernels), microseconds per transform\n"
+             <<"    length     generic       fixed     speedup  float generic\n";
+    const int lengths[] = {4096, 8192, 16384, 65536};
+    for(int n : lengths)
+    {
+        FftPlan& plan = FftPlan::get(n);
+        cmplx* input = new cmplx[n];
+        cmplx* output = new cmplx[n];
+        cmplxf* inputF = new cmplxf[n];
+        cmplxf* outputF = new cmplxf[n];
+        for(int i=0; i<n; i++)
+        {
+            input[i] = cmplx(sin(0.3*i), (i*37)%101);
+            inputF[i] = cmplxf(input[i]);
+        }
+
+        FftPlan::useFixedSize = false;
+        double generic = timeMicroseconds([&]{ plan.forward(output, input); });
+        FftPlan::useFixedSize = true;
+        double fixed = timeMicroseconds([&]{ plan.forward(output, input); });
+        FftPlanF& planF = FftPlanF::get(n);
+        double genericF = timeMicroseconds([&]{ planF.forward(outputF, inputF); });
+
+        printf("%10d  %10.1f  %10.1f  %9.2fx  %13.1f\n", n, generic, fixed, generic/fixed, genericF);
+        delete[] input;
+        delete[] output;
+        delete[] inputF;
+        delete[] outputF;
+    }
+}
+
+/**
+----Single vs double precision----
+FindFrequencyContent() time per call in both precisions, and the accuracy of float.
+**/
+static void BenchmarkPrecision()
+{
+    std::cout<<"\nSingle vs double precision FindFrequencyContent(), microseconds per call\n"
+             <<"    length      double       float     speedup   max rel. error   max magnitude diff\n";
+    bool savedPrecision = getSinglePrecision();
+    const int lengths[] = {4096, 16384, 44100, 65536};
+    for(int n : lengths)
+    {
+        sample* input = new sample[n];
+        sample* output = new sample[n/2+1];
+        makeTestSignal(input, n);
+
+        setSinglePrecision(false);
+        double timeDouble = timeMicroseconds([&]{ FindFrequencyContent(output, input, n); });
+        setSinglePrecision(true);
+        double timeFloat = timeMicroseconds([&]{ FindFrequencyContent(output, input, n); });
+        PrecisionReport report = CheckSinglePrecision(input, n);
+
+        printf("%10d  %10.1f  %10.1f  %9.2fx  %15.2g  %19d\n", n, timeDouble, timeFloat,
+               timeDouble/timeFloat, report.relativeError, report.maxMagnitudeDifference);
+        delete[] input;
+        delete[] output;
+    }
+    setSinglePrecision(savedPrecision);
+}
+
+/**
+----Sample conversion kernels----
+Nanoseconds per sample for each kernel set the CPU supports: widening to float, gain
+(as applied by the queue's volume), windowing, and interleaving.
+**/
+static void BenchmarkSampleKernels()
+{
+    std::cout<<"\nSample conversion kernels, nanoseconds per sample (4096 samples per call)\n"
+             <<"                    scalar        SSE2    AVX2/FMA\n";
+    const char* kernelNames[] = {"scalar", "SSE2", "AVX2/FMA"};
+    const char* savedKernels = dspKernels().name;
+    const int n = 4096;
+    sample* input = new sample[2*n];
+    sample* output = new sample[2*n];
+    sample* right = new sample[n];
+    float* widened = new float[n];
+    makeTestSignal(input, 2*n);
+    const float* window = windowTable(HANN_WINDOW, n);
+
+    const char* rows[] = {"widenF", "gain", "weight", "interleave", "deinterleave"};
+    for(int row=0; row<5; row++)
+    {
+        printf("%-14s", rows[row]);
+        for(const char* name : kernelNames)
+        {
+            if(!setDSPKernels(name))
+            {
+                printf("  %10s", "-");
+                continue;
+            }
+            const DSPKernels& k = dspKernels();
+            double time = 0;
+            switch(row)
+            {
+                case 0: time = timeMicroseconds([&]{ k.widenF(widened, input, n); }, 50); break;
+                case 1: time = timeMicroseconds([&]{ k.gain(output, input, n, 0.7f); }, 50); break;
+                case 2: time = timeMicroseconds([&]{ k.weight(output, input, window, n); }, 50); break;
+                case 3: time = timeMicroseconds([&]{ k.interleave(output, input, input+n, n); }, 50); break;
+                case 4: time = timeMicroseconds([&]{ k.deinterleave(output, right, input, n); }, 50); break;
+            }
+            printf("  %10.3f", time*1000/n);
+        }
+        printf("\n");
+    }
+    setDSPKernels(savedKernels);
+    delete[] input;
+    delete[] output;
+    delete[] right;
+    delete[] widened;
+}
+
+/**
+----Sliding DFT and zoom FFT vs full FFT----
+Time per frame to bring a band of bins up to date after 10 ms and 30 ms of new audio,
+with SlidingDFT, with ZoomFFT (narrow bands only) and with a full FindFrequencyContent().
+**/
+static void BenchmarkSlidingDFT()
+{
+    int n = getFFTLength();
+    std::cout<<"\nSliding DFT and zoom FFT vs full FFT, "<<n<<" samples, microseconds per frame\n"
+             <<"         band   frame      full FFT   sliding DFT   sliding frames      zoom FFT\n";
+    const int bands[][2] = {{200, 400}, {50, 1000}, {50, 5000}, {20, 20000}};
+    const int frameMilliseconds[] = {10, 30};
+
+    int signalLength = 1<<20;
+    sample* signal = new sample[signalLength];
+    makeTestSignal(signal, signalLength);
+    sample* buffer = new sample[n];
+    sample* output = new sample[n/2+1];
+    AudioQueue queue(4*n);
+    int signalPos = 0;
+    auto advance = [&](int count)                                           /// Record count more samples
+    {
+        if(signalPos+count > signalLength)
+            signalPos = 0;
+        queue.push(signal+signalPos, count);
+        signalPos += count;
+    };
+    queue.push(signal, n);
+    signalPos = n;
+
+    for(auto& band : bands)
+        for(int ms : frameMilliseconds)
+        {
+            int k0 = freq2index(band[0]);
+            int k1 = freq2index(band[1]);
+            int frame = RATE*ms/1000;
+            double full = timeMicroseconds([&]{
+                advance(frame);
+                queue.peekFreshData(buffer, n);
+                FindFrequencyContent(output, buffer, n);
+            });
+            SlidingDFT sdft;
+            double sliding = timeMicroseconds([&]{
+                advance(frame);
+                sdft.update(output, queue, queue.samplesPushed(), n, k0, k1);
+            });
+            double slidingShare = (double)sdft.slidingUpdateCount()/(sdft.slidingUpdateCount()+sdft.fullUpdateCount());
+            printf("%6d-%-6d  %3d ms  %12.1f  %12.1f  %14.0f%%", band[0], band[1], ms, full, sliding, 100*slidingShare);
+            if(ZoomFFT::decimationFor(n, k0, k1) > 1)
+            {
+                ZoomFFT zoom;
+                double zoomed = timeMicroseconds([&]{
+                    advance(frame);
+                    zoom.update(output, queue, queue.samplesPushed(), n, k0, k1);
+                });
+                printf("  %12.1f\n", zoomed);
+            }
+            else
+                printf("             -\n");
+        }
+
+    delete[] signal;
+    delete[] buffer;
+    delete[] output;
+}
+
+/**
+----STFT cost per hop size----
+Time per STFT frame (window and full FFT, read in place) and the resulting analysis load: CPU
+time per second of audio, which depends only on the hop size, not on the display.
+**/
+static void BenchmarkSTFT()
+{
+    int n = getFFTLength();
+    int previousHop = getHopSize();
+    std::cout<<"\nSTFT frames, "<<n<<" samples, "<<windowName(getAnalysisWindow())<<" window\n"
+             <<"       hop   frames/s   us per frame   ms per second of audio\n";
+    const int hops[] = {256, 512, 1024, 4096};
+
+    int signalLength = 1<<20;
+    sample* signal = new sample[signalLength];
+    makeTestSignal(signal, signalLength);
+    sample* output = new sample[n/2+1];
+    AudioQueue queue(4*n);
+    int signalPos = 0;
+    for(int hop : hops)
+    {
+        setHopSize(hop);
+        STFT frames;
+        double perFrame = timeMicroseconds([&]{
+            do                                                              /// Record audio until a frame completes
+            {
+                if(signalPos+hop > signalLength)
+                    signalPos = 0;
+                queue.push(signal+signalPos, hop);
+                signalPos += hop;
+            } while(queue.samplesPushed() < (unsigned long long)n);
+            unsigned long long end = frames.next(queue, n);
+            frames.spectrum(output, queue, end, n);
+        });
+        printf("%10d  %9.1f  %13.1f  %23.1f\n", hop, (double)RATE/hop, perFrame, perFrame*RATE/hop/1000);
+    }
+    setHopSize(previousHop);
+
+    delete[] signal;
+    delete[] output;
+}
+
+/**
+----Goertzel bank vs full FFT----
+Time to compute a few bins with GoertzelContent(), against FindFrequencyContent() for
+the whole spectrum, and which one FindBinContent() would pick.
+**/
+static void BenchmarkGoertzel()
+{
+    std::cout<<"\nGoertzel bank vs full FFT, microseconds per call\n"
+             <<"    length   bins    full FFT    Goertzel   FindBinContent() uses\n";
+    const int lengths[] = {4096, 65536};
+    const int binCounts[] = {4, 16, 64};
+    for(int n : lengths)
+    {
+        sample* input = new sample[n];
+        sample* output = new sample[n/2+1];
+        makeTestSignal(input, n);
+        double full = timeMicroseconds([&]{ FindFrequencyContent(output, input, n); });
+        for(int numBins : binCounts)
+        {
+            std::vector<int> bins(numBins);
+            for(int k=0; k<numBins; k++)
+                bins[k] = 1+k*(n/2-1)/numBins;
+            double goertzel = timeMicroseconds([&]{ GoertzelContent(output, input, n, bins.data(), numBins); });
+            printf("%10d  %5d  %10.1f  %10.1f   %s\n", n, numBins, full, goertzel,
+                   goertzelIsFaster(n, numBins) ? "Goertzel" : "FFT");
+        }
+        delete[] input;
+        delete[] output;
+    }
+}
+
+/**
+----Constant-Q vs FFT----
+Time per frame of the constant-Q transform used by the log views, against the full FFT
+they would otherwise do. Frequencies are those of the signal (display frequencies
+are twice these).
+**/
+static void BenchmarkConstantQ()
+{
+    std::cout<<"\nConstant-Q transform vs FFT, 24 bins per octave, microseconds per frame\n"
+             <<"         band      FFT length   FFT time   CQ length   CQ kernel   CQ time\n";
+    struct { double minFreq, maxFreq; int fftlen; } cases[] = {{100, 1000, 65536}, {100, 2500, 65536}, {27.5, 7040, 262144}};
+    for(auto& c : cases)
+    {
+        sample* input = new sample[c.fftlen];
+        sample* output = new sample[c.fftlen/2+1];
+        makeTestSignal(input, c.fftlen);
+        double fftTime = timeMicroseconds([&]{ FindFrequencyContent(output, input, c.fftlen); });
+        ConstantQ cq(c.minFreq, c.maxFreq, 24, c.fftlen);
+        float* cqOutput = new float[cq.bins()];
+        double cqTime = timeMicroseconds([&]{ cq.transform(cqOutput, input); });
+        printf("%6.0f-%-6.0f  %10d  %10.1f  %10d  %10d  %8.1f\n", c.minFreq, c.maxFreq, c.fftlen, fftTime,
+               cq.length(), cq.kernelSize(), cqTime);
+        delete[] input;
+        delete[] output;
+        delete[] cqOutput;
+    }
+}
+
+/**
+----Thread scaling----
+Time per transform with the worker pool at 1, 2, 4 and 8 threads. With 1 thread the
+ordinary single-threaded FFT is used; with more, the four-step algorithm. The last
+column is the default: one thread per core, split only where the plan timed the split
+as faster. The thread count given on the command line (if any) is put back afterwards.
+**/
+static void BenchmarkThreadScaling()
+{
+    std::cout<<"\nThread scaling ("<<std::thread::hardware_concurrency()<<" hardware threads), microseconds per call\n"
+             <<"                                 1 thread   2 threads   4 threads   8 threads   automatic\n";
+    int previousThreads = WorkerPool::requestedThreads();
+    const int threadCounts[] = {1, 2, 4, 8, 0};                             /// 0 = automatic
+    const int lengths[] = {65536, 262144};
+    for(int n : lengths)
+    {
+        cmplx* data = new cmplx[n];
+        for(int i=0; i<n; i++)
+            data[i] = cmplx(sin(0.3*i), (i*37)%101);
+        printf("complex FFT, double %8d", n);
+        for(int threads : threadCounts)
+        {
+            WorkerPool::setThreads(threads);
+            printf("  %10.1f", timeMicroseconds([&]{ fft(data, data, n); }));
+        }
+        printf("\n");
+        delete[] data;
+    }
+
+    int n = 65536;
+    sample* input = new sample[n];
+    sample* output = new sample[n/2+1];
+    makeTestSignal(input, n);
+    printf("FindFrequencyContent %9d", n);
+    for(int threads : threadCounts)
+    {
+        WorkerPool::setThreads(threads);
+        printf("  %10.1f", timeMicroseconds([&]{ FindFrequencyContent(output, input, n); }));
+    }
+    printf("\n");
+    delete[] input;
+    delete[] output;
+
+    WorkerPool::setThreads(previousThreads);
+}
+
+/**
+----Sliding DFT after a long gap----
+A band narrower than log2(n) bins with more than n new samples between frames: still
+cheaper to slide than to recompute, and more samples than the window holds. Compares
+the slid bins against a full FFT of the same samples.
+**/
+static bool CheckSlidingGap(int n)
+{
+    int gap = n+n/4;
+    int frames = std::min(3, (SDFT_RESYNC_SAMPLES-1)/gap);                  /// All before the next resync
+    if(frames == 0)
+    {
+        printf("Sliding DFT: %d-sample gaps are longer than the resync interval, skipped\n", gap);
+        return true;
+    }
+    int k0 = n/16, k1 = k0+2;
+    sample* signal = new sample[n+frames*gap];
+    makeTestSignal(signal, n+frames*gap);
+    sample* buffer = new sample[n];
+    sample* expected = new sample[n/2+1];
+    sample* output = new sample[n/2+1];
+    AudioQueue queue(2*(n+gap));
+    SlidingDFT sdft;
+    queue.push(signal, n);
+    sdft.update(output, queue, queue.samplesPushed(), n, k0, k1);
+    int maxDifference = 0;
+    for(int frame=0; frame<frames; frame++)
+    {
+        queue.push(signal+n+frame*gap, gap);
+        sdft.update(output, queue, queue.samplesPushed(), n, k0, k1);
+        queue.peekFreshData(buffer, n);
+        FindFrequencyContent(expected, buffer, n);
+        for(int k=k0; k<k1; k++)
+            maxDifference = std::max(maxDifference, abs(output[k]-expected[k]));
+    }
+    bool ok = sdft.slidingUpdateCount()==(unsigned long long)frames && maxDifference<=1;
+    printf("Sliding DFT, %d-sample gaps: %llu of %d frames slid, max magnitude difference %d  %s\n",
+           gap, sdft.slidingUpdateCount(), frames, maxDifference, ok ? "OK" : "FAILED");
+    delete[] signal;
+    delete[] buffer;
+    delete[] expected;
+    delete[] output;
+    return ok;
+}
+
+/**
+----Four-step FFT----
+The same transform with one thread (ordinary FFT) and with four (four-step algorithm),
+which must agree to rounding. The four-step buffer appearing in the plan's memory shows
+that the split actually ran.
+**/
+static bool CheckFourStepFFT()
+{
+    int n = 4*PARALLEL_FFT_THRESHOLD;
+    FftPlan& plan = FftPlan::get(n);
+    cmplx* input = new cmplx[n];
+    cmplx* serial = new cmplx[n];
+    cmplx* parallel = new cmplx[n];
+    for(int i=0; i<n; i++)
+        input[i] = cmplx(sin(0.3*i), (i*37)%101);
+
+    int previousThreads = WorkerPool::requestedThreads();
+    WorkerPool::setThreads(1);
+    plan.forward(serial, input);
+    size_t serialMemory = plan.memoryUsage();
+    WorkerPool::setThreads(4);
+    plan.forward(parallel, input);
+    bool split = plan.memoryUsage() > serialMemory;
+    WorkerPool::setThreads(previousThreads);
+
+    double largest = 0, largestError = 0;
+    for(int k=0; k<n; k++)
+    {
+        largest = std::max(largest, abs(serial[k]));
+        largestError = std::max(largestError, abs(parallel[k]-serial[k]));
+    }
+    double relativeError = largestError/largest;
+    bool ok = split && relativeError<1e-12;
+    printf("Four-step FFT, length %d, 4 threads: %s, max relative error %.2g  %s\n",
+           n, split ? "split" : "NOT split", relativeError, ok ? "OK" : "FAILED");
+    delete[] input;
+    delete[] serial;
+    delete[] parallel;
+    return ok;
+}
+
+/**
+----RunPrecisionCheck()----
+Validates the single-precision path against double precision at the current FFT
+length, on a synthetic signal at several levels (quiet to near full scale), then
+the sliding DFT over gaps longer than the window and the four-step FFT.
+**/
+bool RunPrecisionCheck()
+{
+    int n = getFFTLength();
+    sample* input = new sample[n];
+    bool passed = true;
+    const float levels[] = {0.01, 0.1, 1};
+    for(float level : levels)
+    {
+        makeTestSignal(input, n);
+        for(int i=0; i<n; i++)
+            input[i] *= level;
+        PrecisionReport report = CheckSinglePrecision(input, n);
+        bool ok = report.relativeError<PRECISION_TOLERANCE && report.maxMagnitudeDifference<=1;
+        printf("FFT length %d, level %4.2f: max relative error %.2g, max magnitude difference %d  %s\n",
+               n, level, report.relativeError, report.maxMagnitudeDifference, ok ? "OK" : "FAILED");
+        passed = passed && ok;
+    }
+    delete[] input;
+    passed = CheckSlidingGap(n) && passed;
+    passed = CheckFourStepFFT() && passed;
+    return passed;
+}
+
+void RunBenchmarks()
+{
+    BenchmarkFixedSizeFFT();
+    BenchmarkPrecision();
+    BenchmarkSampleKernels();
+    BenchmarkSlidingDFT();
+    BenchmarkSTFT();
+    BenchmarkGoertzel();
+    BenchmarkConstantQ();
+    BenchmarkThreadScaling();
+}
@@ -0,0 +1,22 @@
+/**
+------------------
+----Benchmarks----
+------------------
+RunBenchmarks() times the DSP building blocks on synthetic input and prints a table
+for each. Started with the --benchmark command line option; needs no audio devices.
+**/
+
+void RunBenchmarks();
+
+/**
+----RunPrecisionCheck()----
+Compares the single-precision analysis path against double precision on synthetic
+input at the current FFT length, prints the errors and returns true if they are
+within PRECISION_TOLERANCE (and magnitudes differ by at most 1). Also checks the
+sliding DFT against a full FFT when more samples than the window holds arrive between
+frames, and the four-step FFT against the single-threaded one. Started with the
+--check-precision command line option.
+**/
+#define PRECISION_TOLERANCE 1e-5
+
+bool RunPrecisionCheck();
@@ -0,0 +1,797 @@
+#include "audioDSP.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSP_X86_KERNELS                                                     /// Build SSE2 and AVX2/FMA kernels (selected at runtime)
+#include <immintrin.h>
+#endif
+
+/**
+-----------------------
+----Scalar kernels----
+-----------------------
+Plain C++ versions. Always available, and used on non-x86 machines.
+**/
+static void fftStage_scalar(cmplx* data, int n, const cmplx* w, int m)
+{
+    for(int k=0; k<n; k+=2*m)
+    {
+        cmplx* a = data+k;
+        cmplx* b = data+k+m;
+        for(int j=0; j<m; j++)
+        {
+            cmplx t = w[j]*b[j];
+            b[j] = a[j] - t;
+            a[j] += t;
+        }
+    }
+}
+
+static void magnitudes_scalar(sample* output, const cmplx* input, int n, double scale)
+{
+    for(int i=0; i<n; i++)
+    {
+        double currentvalue = abs(input[i])*scale;
+        output[i] = (sample)(currentvalue>MAX_SAMPLE_VALUE ? MAX_SAMPLE_VALUE : currentvalue);
+    }
+}
+
+static void widen_scalar(double* output, const sample* input, int n)
+{
+    for(int i=0; i<n; i++)
+        output[i] = input[i];
+}
+
+static void slideBins_scalar(cmplx* bins, const cmplx* rotation, int numBins, const double* delta, int count)
+{
+    double* b = reinterpret_cast<double*>(bins);                            /// Written out: std::complex<double> multiply
+    const double* r = reinterpret_cast<const double*>(rotation);            /// checks for infinities every time
+    for(int k=0; k<numBins; k++)
+    {
+        double re = b[2*k], im = b[2*k+1];
+        double wr = r[2*k], wi = r[2*k+1];
+        for(int i=0; i<count; i++)
+        {
+            double t = re+delta[i];
+            re = t*wr - im*wi;
+            im = t*wi + im*wr;
+        }
+        b[2*k] = re;
+        b[2*k+1] = im;
+    }
+}
+
+static void goertzel_scalar(double* power, const double* coeff, int numBins, const double* input, int n)
+{
+    int k = 0;
+    for(; k+4<=numBins; k+=4)                                               /// Four independent recurrences at a time
+    {
+        double c0 = coeff[k], c1 = coeff[k+1], c2 = coeff[k+2], c3 = coeff[k+3];
+        double a0 = 0, a1 = 0, a2 = 0, a3 = 0;                              /// s[i-1]
+        double b0 = 0, b1 = 0, b2 = 0, b3 = 0;                              /// s[i-2]
+        for(int i=0; i<n; i++)
+        {
+            double x = input[i];
+            double t0 = x + c0*a0 - b0, t1 = x + c1*a1 - b1;
+            double t2 = x + c2*a2 - b2, t3 = x + c3*a3 - b3;
+            b0 = a0; b1 = a1; b2 = a2; b3 = a3;
+            a0 = t0; a1 = t1; a2 = t2; a3 = t3;
+        }
+        power[k] = a0*a0 + b0*b0 - c0*a0*b0;
+        power[k+1] = a1*a1 + b1*b1 - c1*a1*b1;
+        power[k+2] = a2*a2 + b2*b2 - c2*a2*b2;
+        power[k+3] = a3*a3 + b3*b3 - c3*a3*b3;
+    }
+    for(; k<numBins; k++)
+    {
+        double c = coeff[k], a = 0, b = 0;
+        for(int i=0; i<n; i++)
+        {
+            double t = input[i] + c*a - b;
+            b = a;
+            a = t;
+        }
+        power[k] = a*a + b*b - c*a*b;
+    }
+}
+
+static void fftStageF_scalar(cmplxf* data, int n, const cmplxf* w, int m)
+{
+    float* d = reinterpret_cast<float*>(data);
+    const float* wd = reinterpret_cast<const float*>(w);
+    for(int k=0; k<n; k+=2*m)
+    {
+        float* a = d+2*k;
+        float* b = d+2*(k+m);
+        for(int j=0; j<m; j++)                                              /// Written out: std::complex<float> multiply is slow
+        {
+            float tr = wd[2*j]*b[2*j] - wd[2*j+1]*b[2*j+1];
+            float ti = wd[2*j]*b[2*j+1] + wd[2*j+1]*b[2*j];
+            b[2*j] = a[2*j] - tr;
+            b[2*j+1] = a[2*j+1] - ti;
+            a[2*j] += tr;
+            a[2*j+1] += ti;
+        }
+    }
+}
+
+static void magnitudesF_scalar(sample* output, const cmplxf* input, int n, float scale)
+{
+    for(int i=0; i<n; i++)
+    {
+        float currentvalue = sqrtf(input[i].real()*input[i].real() + input[i].imag()*input[i].imag())*scale;
+        output[i] = (sample)(currentvalue>MAX_SAMPLE_VALUE ? MAX_SAMPLE_VALUE : currentvalue);
+    }
+}
+
+static void widenF_scalar(float* output, const sample* input, int n)
+{
+    for(int i=0; i<n; i++)
+        output[i] = input[i];
+}
+
+/// Rounded to the nearest sample value, like the SIMD conversions, and clamped.
+static inline sample saturate(float x)
+{
+    x = std::max(-(float)MAX_SAMPLE_VALUE-1, std::min(x, (float)MAX_SAMPLE_VALUE));
+    return (sample)lrintf(x);
+}
+
+static void gain_scalar(sample* output, const sample* input, int n, float gain)
+{
+    for(int i=0; i<n; i++)
+        output[i] = saturate(input[i]*gain);
+}
+
+static void weight_scalar(sample* output, const sample* input, const float* weights, int n)
+{
+    for(int i=0; i<n; i++)
+        output[i] = saturate(input[i]*weights[i]);
+}
+
+static void interleave_scalar(sample* output, const sample* left, const sample* right, int n)
+{
+    for(int i=0; i<n; i++)
+    {
+        output[2*i] = left[i];
+        output[2*i+1] = right[i];
+    }
+}
+
+static void deinterleave_scalar(sample* left, sample* right, const sample* input, int n)
+{
+    for(int i=0; i<n; i++)
+    {
+        left[i] = input[2*i];
+        right[i] = input[2*i+1];
+    }
+}
+
+#ifdef DSP_X86_KERNELS
+
+/**
+---------------------
+----SSE2 kernels----
+---------------------
+One complex double per register. SSE2 has no addsub instruction, so the sign of the
+real part of wi*b is flipped with an xor.
+**/
+__attribute__((target("sse2")))
+static void fftStage_sse2(cmplx* data, int n, const cmplx* w, int m)
+{
+    double* d = reinterpret_cast<double*>(data);
+    const double* wd = reinterpret_cast<const double*>(w);
+    const __m128d negLow = _mm_set_pd(0.0, -0.0);                           /// Flips sign of the low (real) lane
+    for(int k=0; k<n; k+=2*m)
+    {
+        double* a = d+2*k;
+        double* b = d+2*(k+m);
+        for(int j=0; j<m; j++)
+        {
+            __m128d wv = _mm_loadu_pd(wd+2*j);
+            __m128d bv = _mm_loadu_pd(b+2*j);
+            __m128d wr = _mm_unpacklo_pd(wv, wv);                           /// (wr, wr)
+            __m128d wi = _mm_unpackhi_pd(wv, wv);                           /// (wi, wi)
+            __m128d bs = _mm_shuffle_pd(bv, bv, 1);                         /// (bi, br)
+            __m128d t = _mm_add_pd(_mm_mul_pd(wr, bv),                      /// (wr*br - wi*bi, wr*bi + wi*br)
+                                   _mm_xor_pd(_mm_mul_pd(wi, bs), negLow));
+            __m128d av = _mm_loadu_pd(a+2*j);
+            _mm_storeu_pd(b+2*j, _mm_sub_pd(av, t));
+            _mm_storeu_pd(a+2*j, _mm_add_pd(av, t));
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void magnitudes_sse2(sample* output, const cmplx* input, int n, double scale)
+{
+    const double* d = reinterpret_cast<const double*>(input);
+    const __m128d vscale = _mm_set1_pd(scale);
+    const __m128d vmax = _mm_set1_pd(MAX_SAMPLE_VALUE);
+    int i = 0;
+    for(; i+2<=n; i+=2)
+    {
+        __m128d c0 = _mm_loadu_pd(d+2*i);
+        __m128d c1 = _mm_loadu_pd(d+2*i+2);
+        c0 = _mm_mul_pd(c0, c0);
+        c1 = _mm_mul_pd(c1, c1);
+        __m128d mag = _mm_sqrt_pd(_mm_add_pd(_mm_unpacklo_pd(c0, c1), _mm_unpackhi_pd(c0, c1)));
+        mag = _mm_min_pd(_mm_mul_pd(mag, vscale), vmax);
+        __m128i v = _mm_cvttpd_epi32(mag);                                  /// Truncate, like the scalar cast
+        v = _mm_packs_epi32(v, v);
+        int packed = _mm_cvtsi128_si32(v);
+        memcpy(output+i, &packed, 2*sizeof(sample));
+    }
+    magnitudes_scalar(output+i, input+i, n-i, scale);
+}
+
+__attribute__((target("sse2")))
+static void widen_sse2(double* output, const sample* input, int n)
+{
+    int i = 0;
+    for(; i+4<=n; i+=4)
+    {
+        __m128i s = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input+i));
+        __m128i v = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);           /// Sign-extend 4 shorts to ints
+        _mm_storeu_pd(output+i, _mm_cvtepi32_pd(v));
+        _mm_storeu_pd(output+i+2, _mm_cvtepi32_pd(_mm_shuffle_epi32(v, 0xEE)));
+    }
+    widen_scalar(output+i, input+i, n-i);
+}
+
+/// Two bins per register, real and imaginary parts in separate registers, so the
+/// rotation is plain multiplies. Four bins at a time for independent dependency chains.
+__attribute__((target("sse2")))
+static void slideBins_sse2(cmplx* bins, const cmplx* rotation, int numBins, const double* delta, int count)
+{
+    double* b = reinterpret_cast<double*>(bins);
+    const double* r = reinterpret_cast<const double*>(rotation);
+    int k = 0;
+    for(; k+4<=numBins; k+=4)
+    {
+        __m128d re[2], im[2], wr[2], wi[2];
+        for(int g=0; g<2; g++)
+        {
+            __m128d b0 = _mm_loadu_pd(b+2*k+4*g), b1 = _mm_loadu_pd(b+2*k+4*g+2);
+            __m128d r0 = _mm_loadu_pd(r+2*k+4*g), r1 = _mm_loadu_pd(r+2*k+4*g+2);
+            re[g] = _mm_unpacklo_pd(b0, b1);
+            im[g] = _mm_unpackhi_pd(b0, b1);
+            wr[g] = _mm_unpacklo_pd(r0, r1);
+            wi[g] = _mm_unpackhi_pd(r0, r1);
+        }
+        for(int i=0; i<count; i++)
+        {
+            __m128d d = _mm_set1_pd(delta[i]);
+            for(int g=0; g<2; g++)
+            {
+                __m128d t = _mm_add_pd(re[g], d);
+                re[g] = _mm_sub_pd(_mm_mul_pd(t, wr[g]), _mm_mul_pd(im[g], wi[g]));
+                im[g] = _mm_add_pd(_mm_mul_pd(t, wi[g]), _mm_mul_pd(im[g], wr[g]));
+            }
+        }
+        for(int g=0; g<2; g++)
+        {
+            _mm_storeu_pd(b+2*k+4*g, _mm_unpacklo_pd(re[g], im[g]));
+            _mm_storeu_pd(b+2*k+4*g+2, _mm_unpackhi_pd(re[g], im[g]));
+        }
+    }
+    slideBins_scalar(bins+k, rotation+k, numBins-k, delta, count);
+}
+
+/// Two bins per register, four registers (eight bins) at a time.
+__attribute__((target("sse2")))
+static void goertzel_sse2(double* power, const double* coeff, int numBins, const double* input, int n)
+{
+    int k = 0;
+    for(; k+8<=numBins; k+=8)
+    {
+        __m128d c0 = _mm_loadu_pd(coeff+k), c1 = _mm_loadu_pd(coeff+k+2);
+        __m128d c2 = _mm_loadu_pd(coeff+k+4), c3 = _mm_loadu_pd(coeff+k+6);
+        __m128d a0 = _mm_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;                   /// s[i-1]
+        __m128d b0 = a0, b1 = a0, b2 = a0, b3 = a0;                                 /// s[i-2]
+        for(int i=0; i<n; i++)
+        {
+            __m128d x = _mm_set1_pd(input[i]);
+            __m128d t0 = _mm_add_pd(_mm_mul_pd(c0, a0), _mm_sub_pd(x, b0));
+            __m128d t1 = _mm_add_pd(_mm_mul_pd(c1, a1), _mm_sub_pd(x, b1));
+            __m128d t2 = _mm_add_pd(_mm_mul_pd(c2, a2), _mm_sub_pd(x, b2));
+            __m128d t3 = _mm_add_pd(_mm_mul_pd(c3, a3), _mm_sub_pd(x, b3));
+            b0 = a0; b1 = a1; b2 = a2; b3 = a3;
+            a0 = t0; a1 = t1; a2 = t2; a3 = t3;
+        }
+        const __m128d c[4] = {c0, c1, c2, c3}, a[4] = {a0, a1, a2, a3}, b[4] = {b0, b1, b2, b3};
+        for(int g=0; g<4; g++)
+        {
+            __m128d p = _mm_add_pd(_mm_mul_pd(a[g], a[g]), _mm_mul_pd(b[g], b[g]));
+            p = _mm_sub_pd(p, _mm_mul_pd(c[g], _mm_mul_pd(a[g], b[g])));
+            _mm_storeu_pd(power+k+2*g, p);
+        }
+    }
+    goertzel_scalar(power+k, coeff+k, numBins-k, input, n);
+}
+
+/// Single precision: two complex floats per register.
+__attribute__((target("sse2")))
+static void fftStageF_sse2(cmplxf* data, int n, const cmplxf* w, int m)
+{
+    float* d = reinterpret_cast<float*>(data);
+    const float* wd = reinterpret_cast<const float*>(w);
+    if(m==1)
+    {
+        for(int k=0; k<n; k+=2)
+        {
+            __m128 v = _mm_loadu_ps(d+2*k);                                 /// (a, b)
+            __m128 s = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1,0,3,2));          /// (b, a)
+            __m128 sum = _mm_add_ps(v, s);                                  /// (a+b, a+b)
+            __m128 diff = _mm_sub_ps(s, v);                                 /// (b-a, a-b)
+            _mm_storeu_ps(d+2*k, _mm_shuffle_ps(sum, diff, _MM_SHUFFLE(3,2,1,0)));
+        }
+        return;
+    }
+    const __m128 negReal = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);            /// Flips sign of the real lanes
+    for(int k=0; k<n; k+=2*m)
+    {
+        float* a = d+2*k;
+        float* b = d+2*(k+m);
+        for(int j=0; j<m; j+=2)
+        {
+            __m128 wv = _mm_loadu_ps(wd+2*j);
+            __m128 bv = _mm_loadu_ps(b+2*j);
+            __m128 wr = _mm_shuffle_ps(wv, wv, _MM_SHUFFLE(2,2,0,0));
+            __m128 wi = _mm_shuffle_ps(wv, wv, _MM_SHUFFLE(3,3,1,1));
+            __m128 bs = _mm_shuffle_ps(bv, bv, _MM_SHUFFLE(2,3,0,1));
+            __m128 t = _mm_add_ps(_mm_mul_ps(wr, bv), _mm_xor_ps(_mm_mul_ps(wi, bs), negReal));
+            __m128 av = _mm_loadu_ps(a+2*j);
+            _mm_storeu_ps(b+2*j, _mm_sub_ps(av, t));
+            _mm_storeu_ps(a+2*j, _mm_add_ps(av, t));
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void magnitudesF_sse2(sample* output, const cmplxf* input, int n, float scale)
+{
+    const float* d = reinterpret_cast<const float*>(input);
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vmax = _mm_set1_ps(MAX_SAMPLE_VALUE);
+    int i = 0;
+    for(; i+4<=n; i+=4)
+    {
+        __m128 c01 = _mm_loadu_ps(d+2*i);
+        __m128 c23 = _mm_loadu_ps(d+2*i+4);
+        c01 = _mm_mul_ps(c01, c01);
+        c23 = _mm_mul_ps(c23, c23);
+        __m128 sq = _mm_add_ps(_mm_shuffle_ps(c01, c23, _MM_SHUFFLE(2,0,2,0)),   /// re^2 + im^2
+                               _mm_shuffle_ps(c01, c23, _MM_SHUFFLE(3,1,3,1)));
+        __m128 mag = _mm_min_ps(_mm_mul_ps(_mm_sqrt_ps(sq), vscale), vmax);
+        __m128i v = _mm_cvttps_epi32(mag);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(output+i), _mm_packs_epi32(v, v));
+    }
+    magnitudesF_scalar(output+i, input+i, n-i, scale);
+}
+
+__attribute__((target("sse2")))
+static void widenF_sse2(float* output, const sample* input, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i));
+        _mm_storeu_ps(output+i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16)));
+        _mm_storeu_ps(output+i+4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16)));
+    }
+    widenF_scalar(output+i, input+i, n-i);
+}
+
+/// Sample conversion: 8 samples at a time, widened to two registers of 4 floats. Clamping
+/// the floats before converting back keeps huge gains from wrapping around, and packs
+/// saturates what's left.
+__attribute__((target("sse2")))
+static inline __m128i narrow_sse2(__m128 lo, __m128 hi)
+{
+    const __m128 top = _mm_set1_ps(MAX_SAMPLE_VALUE), bottom = _mm_set1_ps(-MAX_SAMPLE_VALUE-1);
+    lo = _mm_max_ps(_mm_min_ps(lo, top), bottom);
+    hi = _mm_max_ps(_mm_min_ps(hi, top), bottom);
+    return _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+}
+
+__attribute__((target("sse2")))
+static void gain_sse2(sample* output, const sample* input, int n, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output+i), narrow_sse2(_mm_mul_ps(lo, g), _mm_mul_ps(hi, g)));
+    }
+    gain_scalar(output+i, input+i, n-i, gain);
+}
+
+__attribute__((target("sse2")))
+static void weight_sse2(sample* output, const sample* input, const float* weights, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output+i),
+                         narrow_sse2(_mm_mul_ps(lo, _mm_loadu_ps(weights+i)), _mm_mul_ps(hi, _mm_loadu_ps(weights+i+4))));
+    }
+    weight_scalar(output+i, input+i, weights+i, n-i);
+}
+
+/// Interleaving only moves 16-bit lanes around, which SSE2 does as fast as memory allows,
+/// so the AVX2 table uses these too.
+__attribute__((target("sse2")))
+static void interleave_sse2(sample* output, const sample* left, const sample* right, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left+i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output+2*i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output+2*i+8), _mm_unpackhi_epi16(l, r));
+    }
+    interleave_scalar(output+2*i, left+i, right+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void deinterleave_sse2(sample* left, sample* right, const sample* input, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+2*i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+2*i+8));
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);              /// Even samples, sign-extended
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(left+i), _mm_packs_epi32(la, lb));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(right+i), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+    }
+    deinterleave_scalar(left+i, right+i, input+2*i, n-i);
+}
+
+/**
+-------------------------
+----AVX2/FMA kernels----
+-------------------------
+Two complex doubles per register. The complex multiply is a single fmaddsub.
+The first stage (m = 1) has unit twiddles and both halves of each butterfly sit in
+the same register, so it is done separately.
+**/
+__attribute__((target("avx2,fma")))
+static void fftStage_avx2(cmplx* data, int n, const cmplx* w, int m)
+{
+    double* d = reinterpret_cast<double*>(data);
+    const double* wd = reinterpret_cast<const double*>(w);
+    if(m==1)
+    {
+        for(int k=0; k<n; k+=2)
+        {
+            __m256d v = _mm256_loadu_pd(d+2*k);                             /// (a, b)
+            __m256d s = _mm256_permute2f128_pd(v, v, 0x01);                 /// (b, a)
+            __m256d sum = _mm256_add_pd(v, s);                              /// (a+b, a+b)
+            __m256d diff = _mm256_sub_pd(s, v);                             /// (b-a, a-b)
+            _mm256_storeu_pd(d+2*k, _mm256_blend_pd(sum, diff, 0xC));       /// (a+b, a-b)
+        }
+        return;
+    }
+    for(int k=0; k<n; k+=2*m)
+    {
+        double* a = d+2*k;
+        double* b = d+2*(k+m);
+        for(int j=0; j<m; j+=2)
+        {
+            __m256d wv = _mm256_loadu_pd(wd+2*j);
+            __m256d bv = _mm256_loadu_pd(b+2*j);
+            __m256d wr = _mm256_movedup_pd(wv);                             /// (wr, wr)
+            __m256d wi = _mm256_permute_pd(wv, 0xF);                        /// (wi, wi)
+            __m256d bs = _mm256_permute_pd(bv, 0x5);                        /// (bi, br)
+            __m256d t = _mm256_fmaddsub_pd(wr, bv, _mm256_mul_pd(wi, bs));  /// (wr*br - wi*bi, wr*bi + wi*br)
+            __m256d av = _mm256_loadu_pd(a+2*j);
+            _mm256_storeu_pd(b+2*j, _mm256_sub_pd(av, t));
+            _mm256_storeu_pd(a+2*j, _mm256_add_pd(av, t));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void magnitudes_avx2(sample* output, const cmplx* input, int n, double scale)
+{
+    const double* d = reinterpret_cast<const double*>(input);
+    const __m256d vscale = _mm256_set1_pd(scale);
+    const __m256d vmax = _mm256_set1_pd(MAX_SAMPLE_VALUE);
+    int i = 0;
+    for(; i+4<=n; i+=4)
+    {
+        __m256d c01 = _mm256_loadu_pd(d+2*i);
+        __m256d c23 = _mm256_loadu_pd(d+2*i+4);
+        __m256d sq = _mm256_hadd_pd(_mm256_mul_pd(c01, c01),                /// (|c0|^2, |c2|^2, |c1|^2, |c3|^2)
+                                    _mm256_mul_pd(c23, c23));
+        sq = _mm256_permute4x64_pd(sq, 0xD8);                               /// Back into order c0, c1, c2, c3
+        __m256d mag = _mm256_min_pd(_mm256_mul_pd(_mm256_sqrt_pd(sq), vscale), vmax);
+        __m128i v = _mm256_cvttpd_epi32(mag);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(output+i), _mm_packs_epi32(v, v));
+    }
+    magnitudes_scalar(output+i, input+i, n-i, scale);
+}
+
+__attribute__((target("avx2,fma")))
+static void widen_avx2(double* output, const sample* input, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i));
+        __m256i v = _mm256_cvtepi16_epi32(s);
+        _mm256_storeu_pd(output+i, _mm256_cvtepi32_pd(_mm256_castsi256_si128(v)));
+        _mm256_storeu_pd(output+i+4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)));
+    }
+    widen_scalar(output+i, input+i, n-i);
+}
+
+/// Four bins per register (in the order 0 2 1 3, undone by the same unpacks on the
+/// way out), eight bins at a time.
+__attribute__((target("avx2,fma")))
+static void slideBins_avx2(cmplx* bins, const cmplx* rotation, int numBins, const double* delta, int count)
+{
+    double* b = reinterpret_cast<double*>(bins);
+    const double* r = reinterpret_cast<const double*>(rotation);
+    int k = 0;
+    for(; k+8<=numBins; k+=8)
+    {
+        __m256d re[2], im[2], wr[2], wi[2];
+        for(int g=0; g<2; g++)
+        {
+            __m256d b0 = _mm256_loadu_pd(b+2*k+8*g), b1 = _mm256_loadu_pd(b+2*k+8*g+4);
+            __m256d r0 = _mm256_loadu_pd(r+2*k+8*g), r1 = _mm256_loadu_pd(r+2*k+8*g+4);
+            re[g] = _mm256_unpacklo_pd(b0, b1);
+            im[g] = _mm256_unpackhi_pd(b0, b1);
+            wr[g] = _mm256_unpacklo_pd(r0, r1);
+            wi[g] = _mm256_unpackhi_pd(r0, r1);
+        }
+        for(int i=0; i<count; i++)
+        {
+            __m256d d = _mm256_set1_pd(delta[i]);
+            for(int g=0; g<2; g++)
+            {
+                __m256d t = _mm256_add_pd(re[g], d);
+                __m256d imwi = _mm256_mul_pd(im[g], wi[g]);
+                __m256d imwr = _mm256_mul_pd(im[g], wr[g]);
+                re[g] = _mm256_fmsub_pd(t, wr[g], imwi);
+                im[g] = _mm256_fmadd_pd(t, wi[g], imwr);
+            }
+        }
+        for(int g=0; g<2; g++)
+        {
+            _mm256_storeu_pd(b+2*k+8*g, _mm256_unpacklo_pd(re[g], im[g]));
+            _mm256_storeu_pd(b+2*k+8*g+4, _mm256_unpackhi_pd(re[g], im[g]));
+        }
+    }
+    slideBins_sse2(bins+k, rotation+k, numBins-k, delta, count);
+}
+
+/// Four bins per register, four registers (sixteen bins) at a time.
+__attribute__((target("avx2,fma")))
+static void goertzel_avx2(double* power, const double* coeff, int numBins, const double* input, int n)
+{
+    int k = 0;
+    for(; k+16<=numBins; k+=16)
+    {
+        __m256d c0 = _mm256_loadu_pd(coeff+k), c1 = _mm256_loadu_pd(coeff+k+4);
+        __m256d c2 = _mm256_loadu_pd(coeff+k+8), c3 = _mm256_loadu_pd(coeff+k+12);
+        __m256d a0 = _mm256_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;                /// s[i-1]
+        __m256d b0 = a0, b1 = a0, b2 = a0, b3 = a0;                                 /// s[i-2]
+        for(int i=0; i<n; i++)
+        {
+            __m256d x = _mm256_set1_pd(input[i]);
+            __m256d t0 = _mm256_fmadd_pd(c0, a0, _mm256_sub_pd(x, b0));
+            __m256d t1 = _mm256_fmadd_pd(c1, a1, _mm256_sub_pd(x, b1));
+            __m256d t2 = _mm256_fmadd_pd(c2, a2, _mm256_sub_pd(x, b2));
+            __m256d t3 = _mm256_fmadd_pd(c3, a3, _mm256_sub_pd(x, b3));
+            b0 = a0; b1 = a1; b2 = a2; b3 = a3;
+            a0 = t0; a1 = t1; a2 = t2; a3 = t3;
+        }
+        const __m256d c[4] = {c0, c1, c2, c3}, a[4] = {a0, a1, a2, a3}, b[4] = {b0, b1, b2, b3};
+        for(int g=0; g<4; g++)
+        {
+            __m256d p = _mm256_fmadd_pd(a[g], a[g], _mm256_mul_pd(b[g], b[g]));
+            p = _mm256_fnmadd_pd(c[g], _mm256_mul_pd(a[g], b[g]), p);
+            _mm256_storeu_pd(power+k+4*g, p);
+        }
+    }
+    goertzel_sse2(power+k, coeff+k, numBins-k, input, n);
+}
+
+/// Single precision: four complex floats per register. Stages with m = 1 and m = 2 have
+/// both halves of each butterfly in the same register and are done separately.
+__attribute__((target("avx2,fma")))
+static void fftStageF_avx2(cmplxf* data, int n, const cmplxf* w, int m)
+{
+    float* d = reinterpret_cast<float*>(data);
+    const float* wd = reinterpret_cast<const float*>(w);
+    if(n<4)                                                                 /// Too short for a 256-bit vector
+    {
+        fftStageF_scalar(data, n, w, m);
+        return;
+    }
+    if(m==1)
+    {
+        for(int k=0; k<n; k+=4)
+        {
+            __m256 v = _mm256_loadu_ps(d+2*k);                              /// (a0, b0, a1, b1)
+            __m256 s = _mm256_permute_ps(v, 0x4E);                          /// (b0, a0, b1, a1)
+            __m256 sum = _mm256_add_ps(v, s);
+            __m256 diff = _mm256_sub_ps(s, v);
+            _mm256_storeu_ps(d+2*k, _mm256_blend_ps(sum, diff, 0xCC));      /// (a0+b0, a0-b0, a1+b1, a1-b1)
+        }
+        return;
+    }
+    if(m==2)
+    {
+        __m128 wv = _mm_loadu_ps(wd);
+        __m128 wr = _mm_moveldup_ps(wv);
+        __m128 wi = _mm_movehdup_ps(wv);
+        for(int k=0; k<n; k+=4)
+        {
+            __m128 av = _mm_loadu_ps(d+2*k);                                /// (a0, a1)
+            __m128 bv = _mm_loadu_ps(d+2*k+4);                              /// (b0, b1)
+            __m128 t = _mm_fmaddsub_ps(wr, bv, _mm_mul_ps(wi, _mm_shuffle_ps(bv, bv, _MM_SHUFFLE(2,3,0,1))));
+            _mm_storeu_ps(d+2*k, _mm_add_ps(av, t));
+            _mm_storeu_ps(d+2*k+4, _mm_sub_ps(av, t));
+        }
+        return;
+    }
+    for(int k=0; k<n; k+=2*m)
+    {
+        float* a = d+2*k;
+        float* b = d+2*(k+m);
+        for(int j=0; j<m; j+=4)
+        {
+            __m256 wv = _mm256_loadu_ps(wd+2*j);
+            __m256 bv = _mm256_loadu_ps(b+2*j);
+            __m256 wr = _mm256_moveldup_ps(wv);                             /// (wr, wr)
+            __m256 wi = _mm256_movehdup_ps(wv);                             /// (wi, wi)
+            __m256 bs = _mm256_permute_ps(bv, 0xB1);                        /// (bi, br)
+            __m256 t = _mm256_fmaddsub_ps(wr, bv, _mm256_mul_ps(wi, bs));
+            __m256 av = _mm256_loadu_ps(a+2*j);
+            _mm256_storeu_ps(b+2*j, _mm256_sub_ps(av, t));
+            _mm256_storeu_ps(a+2*j, _mm256_add_ps(av, t));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void magnitudesF_avx2(sample* output, const cmplxf* input, int n, float scale)
+{
+    const float* d = reinterpret_cast<const float*>(input);
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 vmax = _mm256_set1_ps(MAX_SAMPLE_VALUE);
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m256 c0 = _mm256_loadu_ps(d+2*i);
+        __m256 c4 = _mm256_loadu_ps(d+2*i+8);
+        __m256 sq = _mm256_hadd_ps(_mm256_mul_ps(c0, c0), _mm256_mul_ps(c4, c4));  /// Order c0 c1 c4 c5 c2 c3 c6 c7
+        sq = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sq), 0xD8));  /// Back into order c0..c7
+        __m256 mag = _mm256_min_ps(_mm256_mul_ps(_mm256_sqrt_ps(sq), vscale), vmax);
+        __m256i v = _mm256_cvttps_epi32(mag);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output+i), packed);
+    }
+    magnitudesF_scalar(output+i, input+i, n-i, scale);
+}
+
+__attribute__((target("avx2,fma")))
+static void widenF_avx2(float* output, const sample* input, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i));
+        _mm256_storeu_ps(output+i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s)));
+    }
+    widenF_scalar(output+i, input+i, n-i);
+}
+
+/// 16 samples at a time. packs works within 128-bit lanes, so the packed halves are
+/// put back in order with a permute.
+__attribute__((target("avx2,fma")))
+static inline __m256i narrow_avx2(__m256 lo, __m256 hi)
+{
+    const __m256 top = _mm256_set1_ps(MAX_SAMPLE_VALUE), bottom = _mm256_set1_ps(-MAX_SAMPLE_VALUE-1);
+    lo = _mm256_max_ps(_mm256_min_ps(lo, top), bottom);
+    hi = _mm256_max_ps(_mm256_min_ps(hi, top), bottom);
+    __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+    return _mm256_permute4x64_epi64(packed, 0xD8);
+}
+
+__attribute__((target("avx2,fma")))
+static void gain_avx2(sample* output, const sample* input, int n, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for(; i+16<=n; i+=16)
+    {
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i))));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i+8))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+i), narrow_avx2(_mm256_mul_ps(lo, g), _mm256_mul_ps(hi, g)));
+    }
+    gain_scalar(output+i, input+i, n-i, gain);
+}
+
+__attribute__((target("avx2,fma")))
+static void weight_avx2(sample* output, const sample* input, const float* weights, int n)
+{
+    int i = 0;
+    for(; i+16<=n; i+=16)
+    {
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i))));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input+i+8))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+i),
+                            narrow_avx2(_mm256_mul_ps(lo, _mm256_loadu_ps(weights+i)), _mm256_mul_ps(hi, _mm256_loadu_ps(weights+i+8))));
+    }
+    weight_scalar(output+i, input+i, weights+i, n-i);
+}
+
+#endif // DSP_X86_KERNELS
+
+/**
+--------------------
+----Kernel tables----
+--------------------
+Ordered fastest first. dspKernels() picks the first one the CPU supports.
+**/
+static const DSPKernels kernelTable[] = {
+#ifdef DSP_X86_KERNELS
+    {"AVX2/FMA", true, fftStage_avx2, magnitudes_avx2, widen_avx2, fftStageF_avx2, magnitudesF_avx2, widenF_avx2,
+     slideBins_avx2, goertzel_avx2, gain_avx2, weight_avx2, interleave_sse2, deinterleave_sse2},
+    {"SSE2", false, fftStage_sse2, magnitudes_sse2, widen_sse2, fftStageF_sse2, magnitudesF_sse2, widenF_sse2,
+     slideBins_sse2, goertzel_sse2, gain_sse2, weight_sse2, interleave_sse2, deinterleave_sse2},
+#endif
+    {"scalar", false, fftStage_scalar, magnitudes_scalar, widen_scalar, fftStageF_scalar, magnitudesF_scalar, widenF_scalar,
+     slideBins_scalar, goertzel_scalar, gain_scalar, weight_scalar, interleave_scalar, deinterleave_scalar}
+};
+static const int numKernels = sizeof(kernelTable)/sizeof(kernelTable[0]);
+
+static bool cpuSupports(const DSPKernels& k)
+{
+#ifdef DSP_X86_KERNELS
+    __builtin_cpu_init();
+    if(k.avx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if(strcmp(k.name, "SSE2")==0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+static const DSPKernels* selectedKernels = nullptr;
+
+const DSPKernels& dspKernels()
+{
+    if(selectedKernels == nullptr)
+    {
+        int i = 0;
+        while(!cpuSupports(kernelTable[i]))                                 /// Scalar (last entry) is always supported
+            i++;
+        selectedKernels = &kernelTable[i];
+    }
+    return *selectedKernels;
+}
+
+bool setDSPKernels(const char* name)
+{
+    for(int i=0; i<numKernels; i++)
+        if(strcmp(kernelTable[i].name, name)==0 && cpuSupports(kernelTable[i]))
+        {
+            selectedKernels = &kernelTable[i];
+            return true;
+        }
+    return false;
+}
@@ -1,40 +1,260 @@
 #include "helper.h"
 
-void show_bargraph(int bars[], int n_bars, int height,                  /// Histogram plotter
-                   int hScale, float vScale, char symbol)
+#define SCREEN_RUN_GAP 8                                                /// Unchanged cells worth rewriting to save a cursor move
+
+/// Appends n cells to output as UTF-8
+static void appendUtf8(std::string& output, const char16_t* cells, int n)
 {
-    char* Graph = new char[2*(n_bars+1)*(height+1)+1];                  /// String that will be printed
-    int chnum = 0;                                                      /// Number of characters added to string Graph
-    for(int i=height; i>=0; i--)                                        /// Iterating through rows (height is the number of rows)
+    for(int i=0; i<n; i++)
     {
-        for(int j=0; j<n_bars; j++)                                     /// Iterating through columns
-            if(bars[j]*vScale>i)                                        /// Add symbols to string if (row, column) is below (bar value, column)
-                for(int k=0; k<hScale; k++)
-                    Graph[chnum++] = symbol;
-            else                                                        /// Else add whitespaces
-                for(int k=0; k<hScale; k++)
-                    Graph[chnum++] = ' ';
-        Graph[chnum++] = '\n';                                          /// Next row
+        unsigned c = cells[i];
+        if(c < 0x80)
+            output += (char)c;
+        else if(c < 0x800)
+        {
+            output += (char)(0xC0 | c>>6);
+            output += (char)(0x80 | (c&0x3F));
+        }
+        else
+        {
+            output += (char)(0xE0 | c>>12);
+            output += (char)(0x80 | (c>>6&0x3F));
+            output += (char)(0x80 | (c&0x3F));
+        }
+    }
+}
+
+ConsoleScreen::ConsoleScreen(int w, int h)
+{
+    width = height = 0;
+    ansi = -1;
+    frameCount = writeCount = byteCount = 0;
+    resize(w, h);
+}
+
+void ConsoleScreen::resize(int w, int h)
+{
+    w = std::max(w, 1);
+    h = std::max(h, 1);
+    if(w == width && h == height)
+        return;
+    width = w;
+    height = h;
+    cells.assign(width*height, u' ');
+    row = col = 0;
+    reset();
+}
+
+void ConsoleScreen::clear()
+{
+    cells.assign(width*height, u' ');
+    row = col = 0;
+}
+
+void ConsoleScreen::reset()
+{
+    clear();
+    shown.clear();
+    shownRow = -1;
+}
+
+void ConsoleScreen::newLine()
+{
+    col = 0;
+    if(row < height-1)
+        row++;
+    else                                                                /// Scroll
+    {
+        cells.erase(0, width);
+        cells.append(width, u' ');
+    }
+}
+
+/// Moves the console's cursor to (r, c), unless it is there already
+void ConsoleScreen::moveTo(int r, int c)
+{
+    if(r == shownRow && c == shownCol)
+        return;
+    char move[32];
+    output.append(move, sprintf(move, "\x1b[%d;%dH", r+1, c+1));
+    shownRow = r;
+    shownCol = c;
+}
+
+void ConsoleScreen::send()
+{
+    std::cout.flush();                                                  /// Anything printed before goes first
+    consoleWrite(output.data(), output.size());
+    writeCount++;
+    byteCount += output.size();
+}
+
+void ConsoleScreen::present()
+{
+    frameCount++;
+    output.clear();
+    if(ansi < 0)                                                        /// First time: ANSI sequences have to be turned on in the Windows console
+        ansi = consoleEnableAnsi();
+    if(getBarStyle() != TEXT_BARS)                                      /// And UTF-8, for the Unicode bars
+        consoleUseUtf8();
+
+    if(!ansi)                                                           /// Whole grid, the old way
+    {
+        system("cls");
+        for(int r=0; r<height; r++)
+        {
+            int end = width;                                            /// Without trailing spaces, so lines don't wrap
+            while(end > 0 && cells[r*width+end-1] == u' ')
+                end--;
+            appendUtf8(output, cells.data() + r*width, end);
+            if(r < height-1)
+                output += '\n';
+        }
+        send();
+        return;
+    }
+
+    if(shown.empty())                                                   /// Console contents unknown: clear it and draw everything
+    {
+        output += "\x1b[2J";
+        shown.assign(width*height, u' ');
+        shownRow = -1;
+    }
+
+    for(int r=0; r<height; r++)
+    {
+        const char16_t* now = cells.data() + r*width;
+        char16_t* was = &shown[r*width];
+        int c = 0;
+        while(c < width)
+        {
+            if(now[c] == was[c])
+            {
+                c++;
+                continue;
+            }
+            int end = c+1;                                              /// One past the last changed cell of the run
+            for(int i=c+1, same=0; i<width && same<SCREEN_RUN_GAP; i++)
+            {
+                if(now[i] == was[i])
+                    same++;
+                else
+                {
+                    end = i+1;
+                    same = 0;
+                }
+            }
+            moveTo(r, c);
+            appendUtf8(output, now+c, end-c);
+            memcpy(was+c, now+c, (end-c)*sizeof(char16_t));
+            shownCol = end;
+            if(end == width)                                            /// Where the cursor goes after the last column depends on the console
+                shownRow = -1;
+            c = end;
+        }
     }
+    moveTo(row, std::min(col, width-1));                                /// Leave the cursor where print() would carry on
+    if(!output.empty())
+        send();
+}
+
+static BarStyle barStyle = TEXT_BARS;
+static const char* barStyleNames[] = {"text", "blocks", "braille"};
+
+BarStyle getBarStyle()
+{
+    return barStyle;
+}
+
+void setBarStyle(BarStyle style)
+{
+    barStyle = style;
+}
+
+bool setBarStyle(const char* name)
+{
+    for(int s=TEXT_BARS; s<=BRAILLE_BARS; s++)
+        if(strcmp(name, barStyleNames[s])==0)
+        {
+            barStyle = (BarStyle)s;
+            return true;
+        }
+    return false;
+}
+
+const char* barStyleName(BarStyle style)
+{
+    return barStyleNames[style];
+}
 
-    for(int j=0; j<n_bars*hScale-1; j++)                                /// Add extra line of symbols at the bottom
-        Graph[chnum++] = symbol;
+int barsPerColumn()
+{
+    return barStyle==BRAILLE_BARS ? 2 : 1;
+}
+
+/// How much of a cell (row) a bar of height level (in rows) fills, in steps of 1/steps
+static int cellFill(float level, int row, int steps)
+{
+    float fill = (level-row)*steps;
+    return fill>=steps ? steps : fill<=0 ? 0 : (int)fill;
+}
+
+void show_bargraph(ConsoleScreen& screen, const int bars[], int n_bars, int height,     /// Histogram plotter
+                   int hScale, float vScale, char symbol)
+{
+    /// Braille dots of the left and right halves of a cell, from the bottom up
+    static const int brailleDots[2][4] = {{0x40, 0x04, 0x02, 0x01}, {0x80, 0x20, 0x10, 0x08}};
 
-    Graph[chnum++] = '\0';                                              /// Null-terminate string
+    int columns = n_bars*hScale;
+    if(barStyle == BRAILLE_BARS)
+        columns = (n_bars+1)/2;                                         /// hScale doesn't apply
 
-    std::cout<<Graph;                                                   /// Print to console
+    for(int i=height; i>=0; i--)                                        /// Iterating through rows (height is the number of rows)
+    {
+        if(barStyle == BRAILLE_BARS)
+            for(int j=0; j<n_bars; j+=2)                                /// Two bars to a cell
+            {
+                int dots = 0;
+                for(int half=0; half<2 && j+half<n_bars; half++)
+                    for(int k=cellFill(bars[j+half]*vScale, i, 4)-1; k>=0; k--)
+                        dots |= brailleDots[half][k];
+                if(dots)
+                    screen.put(0x2800+dots);
+                else
+                    screen.print(' ');
+            }
+        else
+            for(int j=0; j<n_bars; j++)                                 /// Iterating through columns
+            {
+                char16_t block = 0;
+                if(barStyle == BLOCK_BARS)                              /// Eighth block, or none
+                {
+                    int eighths = cellFill(bars[j]*vScale, i, 8);
+                    block = eighths ? 0x2580+eighths : 0;
+                }
+                else if(bars[j]*vScale>i)                               /// Symbol if (row, column) is below (bar value, column)
+                    block = symbol;
+                for(int k=0; k<hScale; k++)
+                    if(block)
+                        screen.put(block);
+                    else                                                /// Else whitespace
+                        screen.print(' ');
+            }
+        screen.print('\n');                                             /// Next row
+    }
 
-    delete[] Graph;
+    for(int j=0; j<columns-1; j++)                                      /// Add extra line of symbols at the bottom
+        screen.print(symbol);
 }
 
 float index2freq(int index)
 {
-    return 2*(float)index*(float)RATE/(float)FFTLEN;
+    return 2*(float)index*(float)RATE/(float)getFFTLength();
 }
 
 float freq2index(float freq)
 {
-    return 0.5*freq*(float)FFTLEN/(float)RATE;
+    return 0.5*freq*(float)getFFTLength()/(float)RATE;
 }
 
 /**
@@ -136,7 +356,7 @@ kept.
 void Find_n_Largest(int* output, sample* input, int n_out, int n_in, bool ignore_clumped)
 {
     /// First, find the position of the smallest element in the input array
-    sample min_pos = 0;
+    int min_pos = 0;
     for(int i=0; i<n_in; i++)
         if(input[i]<input[min_pos])
             min_pos = i;
@@ -162,7 +382,7 @@ void Find_n_Largest(int* output, sample* input, int n_out, int n_in, bool ignore
         /// i.e., check if the index of the previous input element has been added to the output
         bool part_of_clump = false;
         int OutputClumpMate;
-        if(output[i] == min_pos+1)                                      /// The (min_pos)th element is a non-spike,
+        if(i == min_pos+1)                                              /// The (min_pos)th element is a non-spike,
             part_of_clump = false;                                      /// so the (min_pos+1)th element cannot be part of a clump
         else if(i>0)                                                    /// Only elements input[i>0] have a previous element to check
         {
@@ -1,9 +1,112 @@
 #include <iostream>
 #include <math.h>
+#include <string>
 #include "audioDSP.h"
 
-void show_bargraph(int bars[], int n_bars, int height=50,               /// Histogram plotter
-                   int hScale = 1, float vScale = 1, char symbol='|');
+/**
+----Console output----
+The Windows console calls behind ConsoleScreen. They are defined in visualizer.cpp with
+the rest of the code that uses <windows.h>, so that helper.cpp doesn't need it.
+consoleWrite() sends n bytes to the console in one WriteFile() call.
+consoleEnableAnsi() turns on ANSI escape sequences; false if the console can't take them.
+consoleUseUtf8() makes the console decode what it is sent as UTF-8. The console's own
+code page is saved the first time and put back when the program exits.
+**/
+void consoleWrite(const char* data, int n);
+bool consoleEnableAnsi();
+void consoleUseUtf8();
+
+/**
+---------------------------
+----class ConsoleScreen----
+---------------------------
+Draws to the console a frame at a time without clearing it. Text is print()ed into a
+grid of cells the size of the console, as it would be to the console itself: '\n'
+starts the next line (scrolling the grid up at the bottom), '\r' goes back to the start
+of the line, and anything past the right edge is cut off. put() prints one Unicode
+character (from the Basic Multilingual Plane) to a cell, and cells are sent to the
+console as UTF-8. Only the BLOCK_BARS and BRAILLE_BARS styles put anything but ASCII in
+the grid, so the console is only switched to UTF-8 for them; text bars leave its code
+page alone. The grid and cursor are kept between frames, so a view can rewrite
+one line and leave the rest.
+
+present() sends the console only the cells that changed since the last present(), as
+runs of text placed with ANSI cursor moves, in a single write from a buffer that is
+kept from frame to frame. Runs less than SCREEN_RUN_GAP cells apart are sent as one,
+since a cursor move costs about as much. clear() blanks the grid and homes the cursor,
+like "cls". reset() also forgets what the console shows, so that the next present()
+redraws everything; resize() does the same when the size changes, and reset() is needed
+after anything else is printed to the console. Consoles that don't take ANSI sequences
+get system("cls") and a full redraw every present().
+
+frames() counts present() calls, writes() and bytes() the consoleWrite() calls they
+made and the bytes in them. present() flushes std::cout first, so that anything printed
+before isn't drawn over; that goes out separately and isn't counted.
+**/
+class ConsoleScreen
+{
+    int width, height;
+    std::u16string cells;                                               /// What the next present() shows, row by row
+    std::u16string shown;                                               /// What the console shows, empty if unknown
+    std::string output;                                                 /// What present() sends
+    int row, col;                                                       /// Cursor for print()
+    int shownRow, shownCol;                                             /// Console's cursor, row -1 if unknown
+    int ansi;                                                           /// Whether the console takes ANSI sequences, -1 until set up
+    unsigned long long frameCount, writeCount, byteCount;
+
+    ConsoleScreen(const ConsoleScreen&);                                /// Not copyable
+    ConsoleScreen& operator=(const ConsoleScreen&);
+    void newLine();
+    void moveTo(int r, int c);
+    void send();
+  public:
+    ConsoleScreen(int w = 80, int h = 25);
+    void resize(int w, int h);
+    void clear();
+    void reset();
+    void print(char c)
+    {
+        if(c == '\n')
+            newLine();
+        else if(c == '\r')
+            col = 0;
+        else if(col < width)
+            cells[row*width + col++] = (unsigned char)c;
+    }
+    void print(const char* text) { while(*text) print(*text++); }
+    void put(char16_t glyph)
+    {
+        if(col < width)
+            cells[row*width + col++] = glyph;
+    }
+    void present();
+    int columns() const { return width; }
+    int rows() const { return height; }
+    unsigned long long frames() const { return frameCount; }
+    unsigned long long writes() const { return writeCount; }           /// consoleWrite() calls
+    unsigned long long bytes() const { return byteCount; }
+};
+
+/**
+----Bar style----
+How show_bargraph() draws bars. TEXT_BARS (the default) fills whole cells with the
+given symbol. BLOCK_BARS tops each bar with one of the eighth blocks U+2581 to U+2588,
+for 8 times the vertical resolution. BRAILLE_BARS draws braille patterns (U+2800 to
+U+28FF), 2 dots wide and 4 high to a cell: 2 bars to a column, at 4 times the vertical
+resolution. The Unicode styles need a console font that has the characters.
+
+barsPerColumn() is the number of bars the current style fits in one column.
+**/
+enum BarStyle { TEXT_BARS, BLOCK_BARS, BRAILLE_BARS };
+
+BarStyle getBarStyle();
+void setBarStyle(BarStyle style);
+bool setBarStyle(const char* name);                                     /// "text", "blocks" or "braille". False if unknown.
+const char* barStyleName(BarStyle style);
+int barsPerColumn();
+
+void show_bargraph(ConsoleScreen& screen, const int bars[], int n_bars, /// Histogram plotter, in the current bar style
+                   int height=50, int hScale = 1, float vScale = 1, char symbol='|');
 
 float index2freq(int index);
 
@@ -5,12 +5,17 @@
 #include <conio.h>
 #include <SDL2/SDL.h>
 #include "visualizer.h"
+#include "benchmark.h"
 
 #define REFRESH_TIME 10                 /// Time in milliseconds. Sets (maximum) refresh rate.
+#define RUN_TIME 600000                 /// Time in milliseconds before the visualizer returns by itself
+#define KEY_POLL_TIME 50                /// Time in milliseconds between keyboard checks
+#define CONSOLE_POLL_TIME 100           /// Time in milliseconds between console size checks
 
 float echoVolume;                       /// Anything recorded is immediately (-ish) played back at this volume.
 
-AudioQueue MainAudioQueue(10000000);    /// Main queue. Recorded Audio is pushed, popped audio is played, and peeked audio is FFT'd.
+AudioQueue MainAudioQueue(10000000);    /// Main queue. Recorded Audio is pushed, read audio is played, and peeked audio is FFT'd.
+AudioReader PlaybackReader(MainAudioQueue, "playback");    /// The echo's own cursor into MainAudioQueue
 
 /**
 --------------------------
@@ -35,7 +40,24 @@ void RecCallback(void* userdata, Uint8* stream, int streamLength)
 void PlayCallback(void* userdata, Uint8* stream, int streamLength)
 {
     Uint32 length = (Uint32)streamLength;
-    MainAudioQueue.pop((sample*)stream, length/sizeof(sample), ::echoVolume);
+    PlaybackReader.read((sample*)stream, length/sizeof(sample), ::echoVolume);
+}
+
+/// Bytes allocated by each part of the program, for --memory-report
+void ReportMemory()
+{
+    size_t queue = MainAudioQueue.memoryUsage();
+    size_t plans = FftPlan::cacheMemory();
+    size_t plansF = FftPlanF::cacheMemory();
+    size_t windows = windowTableMemory();
+    size_t visualizers = VisualizerMemory();
+    std::cout<<"\nMemory use (bytes)"
+             <<"\n    Audio queue:                "<<queue
+             <<"\n    FFT plans (double):         "<<plans
+             <<"\n    FFT plans (float):          "<<plansF
+             <<"\n    Window tables:              "<<windows
+             <<"\n    Visualizer analysis state:  "<<visualizers
+             <<"\n    Total:                      "<<queue+plans+plansF+windows+visualizers<<"\n";
 }
 
 /// Function to determine whether x key is currently pressed (exit condition)
@@ -48,8 +70,61 @@ char capture_button_press()
 
 int main(int argc, char** argv)
 {
+    bool lowMemory = false;
+    bool memoryReport = false;
+
+    /// Command line options
+    for(int i=1; i<argc; i++)
+    {
+        if(strncmp(argv[i], "--fftlen=", 9)==0)                     /// FFT length, any value in [MIN_FFTLEN, MAX_FFTLEN]
+        {
+            if(!setFFTLength(atoi(argv[i]+9)))
+                std::cerr<<"Invalid FFT length "<<argv[i]+9<<", using "<<getFFTLength()<<"\n";
+        }
+        else if(strncmp(argv[i], "--threads=", 10)==0)              /// Worker threads for large FFTs (0 = one per core)
+            WorkerPool::setThreads(atoi(argv[i]+10));
+        else if(strncmp(argv[i], "--hop=", 6)==0)                   /// Samples between analysis frames
+        {
+            if(!setHopSize(atoi(argv[i]+6)))
+                std::cerr<<"Invalid hop size "<<argv[i]+6<<", using "<<getHopSize()<<"\n";
+        }
+        else if(strncmp(argv[i], "--window=", 9)==0)                /// Analysis window
+        {
+            if(!setAnalysisWindow(argv[i]+9))
+                std::cerr<<"Unknown window "<<argv[i]+9<<", using "<<windowName(getAnalysisWindow())<<"\n";
+        }
+        else if(strncmp(argv[i], "--bars=", 7)==0)                  /// How bars are drawn
+        {
+            if(!setBarStyle(argv[i]+7))
+                std::cerr<<"Unknown bar style "<<argv[i]+7<<", using "<<barStyleName(getBarStyle())<<"\n";
+        }
+        else if(strcmp(argv[i], "--float")==0)                      /// Analysis precision
+            setSinglePrecision(true);
+        else if(strcmp(argv[i], "--double")==0)
+            setSinglePrecision(false);
+        else if(strcmp(argv[i], "--low-memory")==0)                 /// Audio queue only as long as analysis needs
+            lowMemory = true;
+        else if(strcmp(argv[i], "--memory-report")==0)              /// Print memory use on exit
+            memoryReport = true;
+        else if(strcmp(argv[i], "--benchmark")==0)                  /// Time DSP code and exit
+        {
+            RunBenchmarks();
+            return 0;
+        }
+        else if(strcmp(argv[i], "--check-precision")==0)            /// Validate float against double and exit
+            return RunPrecisionCheck() ? 0 : 1;
+        else
+            std::cerr<<"Unknown option "<<argv[i]<<"\n";
+    }
+
+    /// Nothing has been pushed yet, so the queue can still be resized
+    if(lowMemory)
+        MainAudioQueue.resize(queueLengthFor(getFFTLength(), getHopSize()));
+
     SDL_Init(SDL_INIT_AUDIO);                                       /// Initialize SDL audio
 
+    std::cout<<"Using "<<dspKernels().name<<" DSP kernels\n";       /// Picks fastest FFT kernels for this CPU
+
     SDL_AudioSpec RecAudiospec, PlayAudiospec;                      /// SDL_AudioSpec objects used to tell SDL sample rate, buffer size etc.
 
     /// Setting audio parameters
@@ -97,9 +172,22 @@ int main(int argc, char** argv)
         <<"\n\nMusic Algorithms\n----------------"
         <<"\n9 . Pitch recognition (automatic tuner)"
         <<"\n10. Chord Guesser"
+        <<"\n\nSplit View\n----------"
+        <<"\n11. Adaptive log-log, spectral tuner, automatic tuner and chord guesser"
+        <<"\n\nPerceptual Spectrum\n-------------------"
+        <<"\n12. Adaptive mel"
+        <<"\n13. Adaptive bark"
+        <<"\n14. Adaptive ERB"
         <<"\n\nEnter choice: ";
-    std::cin>>ans;
-    if(ans<7)
+    if(!(std::cin>>ans))                                            /// Input closed or not a number
+        return 0;
+    if(ans<1 || ans>14)
+    {
+        system("cls");
+        std::cout<<"No option "<<ans<<"\n\n";
+        goto MAIN_MENU;
+    }
+    if(ans<7 || ans>=11)
     {
         std::cout<<"\nEnter lower frequency limit: ";
         std::cin>>lim1;
@@ -118,14 +206,24 @@ int main(int argc, char** argv)
     std::cout<<"\nStarting...\nDuring execution, press x to exit or m to return to menu";
     SDL_Delay(1000);
     system("cls");
+    VisualizerScreen().reset();                                     /// Drawn in full on the first frame
 
-    /// Screen refresh loop. Run for at least 10 minutes or until x is pressed
-    for(int i=0; i<600000/REFRESH_TIME; i++)
+    /// Screen refresh loop, paced by the scheduler. Run for 10 minutes or until x is pressed
+    FrameScheduler scheduler(REFRESH_TIME);
+    Uint32 startTime = SDL_GetTicks();
+    Uint32 lastKeyPoll = startTime;
+    Uint32 lastConsolePoll = 0;
+    while(SDL_GetTicks()-startTime < RUN_TIME)
     {
         bool windowChanged = false;
+        bool drawn = false;
+
+        scheduler.wait();
+        Uint32 now = SDL_GetTicks();
 
-        if(i%10==0)
+        if(consoleWidth==0 || now-lastConsolePoll >= CONSOLE_POLL_TIME)
         {
+            lastConsolePoll = now;
             GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
             new_consoleWidth = csbi.srWindow.Right - csbi.srWindow.Left;
             new_consoleHeight = csbi.srWindow.Bottom - csbi.srWindow.Top;
@@ -135,88 +233,122 @@ int main(int argc, char** argv)
 
             consoleWidth = new_consoleWidth;
             consoleHeight = new_consoleHeight;
+            VisualizerScreen().resize(consoleWidth+1, consoleHeight+1);
         }
 
         switch(ans)
         {
             case 1 :
                 {
-                    SemilogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = SemilogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight);
                     break;
                 }
             case 2 :
                 {
-                    LinearVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = LinearVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight);
                     break;
                 }
             case 3 :
                 {
-                    LoglogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = LoglogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight);
                     break;
                 }
             case 4 :
                 {
-                    SemilogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = SemilogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
                     break;
                 }
             case 5 :
                 {
-                    LinearVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = LinearVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
                     break;
                 }
             case 6 :
                 {
-                    LoglogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = LoglogVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
                     break;
                 }
             case 7 :
                 {
-                    SpectralTuner(MainAudioQueue, consoleWidth, consoleHeight);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = SpectralTuner(MainAudioQueue, consoleWidth, consoleHeight);
                     break;
                 }
             case 8 :
                 {
-                    SpectralTuner(MainAudioQueue, consoleWidth, consoleHeight, true);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = SpectralTuner(MainAudioQueue, consoleWidth, consoleHeight, true);
                     break;
                 }
             case 9 :
                 {
-                    if(windowChanged)
-                        system("cls");
-                    AutoTuner(MainAudioQueue, consoleWidth, windowChanged);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = AutoTuner(MainAudioQueue, consoleWidth, windowChanged);
                     break;
                 }
             case 10:
                 {
-                    ChordGuesser(MainAudioQueue);
-                    SDL_Delay(REFRESH_TIME);
+                    drawn = ChordGuesser(MainAudioQueue);
+                    break;
+                }
+            case 11:
+                {
+                    View views[] = {{LOGLOG_VIEW, lim1, lim2, true}, {SPECTRAL_TUNER_VIEW, 0, 0, true},
+                                    {AUTO_TUNER_VIEW, 0, 0, false}, {CHORD_VIEW, 0, 0, false}};
+                    drawn = SplitVisualizer(views, 4, MainAudioQueue, consoleWidth, consoleHeight);
+                    break;
+                }
+            case 12:
+                {
+                    drawn = MelVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
+                    break;
+                }
+            case 13:
+                {
+                    drawn = BarkVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
+                    break;
+                }
+            case 14:
+                {
+                    drawn = ErbVisualizer(lim1, lim2, MainAudioQueue, consoleWidth, consoleHeight, true);
                     break;
                 }
-            default: return 0;
         }
+        scheduler.frameDone(drawn);
 
-        char button_press = capture_button_press();
-        if(button_press == 'x')
-            break;
-        else if(button_press == 'm')
+        if(now-lastKeyPoll >= KEY_POLL_TIME)
         {
-            system("cls");
-            goto MAIN_MENU;
+            lastKeyPoll = now;
+            char button_press = capture_button_press();
+            if(button_press == 'x')
+                break;
+            else if(button_press == 'm')
+            {
+                StopAnalysisThread();                               /// Not left running while the menu waits, or on exit from it
+                system("cls");
+                goto MAIN_MENU;
+            }
         }
     }
 
+    StopAnalysisThread();                                           /// Stops reading MainAudioQueue
+
+    std::cout<<"\nDisplay: "<<scheduler.framesDrawn()<<" frames at "<<scheduler.fps()<<" fps ("<<1000/REFRESH_TIME<<" at most), "
+             <<scheduler.missedDeadlines()<<" missed deadlines, frame time "<<scheduler.meanFrameTime()<<" ms mean, "
+             <<scheduler.worstFrameTime()<<" ms worst\n";
+    const ConsoleScreen& screen = VisualizerScreen();
+    if(screen.frames())
+        std::cout<<"Console output: "<<screen.bytes()/screen.frames()<<" bytes and "<<(double)screen.writes()/screen.frames()
+                 <<" writes per frame\n";
+
     /// Close audio devices
     SDL_CloseAudioDevice(PlayDevice);
     SDL_CloseAudioDevice(RecDevice);
 
+    /// The callbacks only count queue trouble. Report it now that they have stopped.
+    for(const AudioReader* reader : MainAudioQueue.readers())
+        if(reader->overrunCount() || reader->underrunCount())
+            std::cout<<"\nAudio queue reader \""<<reader->name()<<"\": "<<reader->overrunCount()<<" samples skipped (overrun), "
+                     <<reader->underrunCount()<<" samples missing (underrun), largest lag "<<reader->maximumLag()<<" samples\n";
+    if(memoryReport)
+        ReportMemory();
+
     return 0;
 }
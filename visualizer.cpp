@@ -1,434 +1,300 @@
 #include "visualizer.h"
 
 /**
---------------------------------------
-----Visualizer Function Parameters----
---------------------------------------
-minfreq and maxfreq are the horizontal (frequency) bounds of the spectral histogram.
-
-adaptive sets whether to continually adjust vertical scaling to fit and fill console
-window.
-
-iterations is the total number of refresh cycles before function return.
-
-delayMicroseconds sets the visualizer refresh rate or "frame rate".
-
-graphScale sets the vertical scale of data relative to the console window height.
-Irrelevant if adaptive is enabled.
+----Analysis buffers----
+Audio array used by the analysis. The FFT length is chosen at runtime, so it can't live
+on the stack. Only reallocated when the length changes.
 **/
+static sample* workingBuffer = nullptr;                                 /// Array to hold audio
+static int bufferLength = 0;
 
-void SemilogVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
-                        bool adaptive, float graphScale)
+static void prepareBuffers(int fftlen)
 {
-    sample workingBuffer[FFTLEN];                                       /// Array to hold audio
-    sample spectrum[FFTLEN];                                            /// Array to hold FFT coefficient magnitudes
-
-    int numbars = consoleWidth;                                         /// Number of bars in the histogram. Will be set to console window width.
-    int graphheight = consoleHeight;                                    /// Height of histogram in lines. Will be set to console window height.
-
-    int bargraph[1000];                                                 /// The histogram
-
-    int Freq0idx = freq2index(minfreq);                                 /// Index in spectrum[] corresponding to minfreq
-    int FreqLidx = freq2index(maxfreq);                                 /// Index in spectrum[] corresponding to maxfreq
+    if(fftlen == bufferLength)
+        return;
+    delete[] workingBuffer;
+    workingBuffer = new sample[fftlen];
+    bufferLength = fftlen;
+}
 
-    /// Get audio from AudioQueue and perform spectral analysis
-    MainAudioQueue.peekFreshData(workingBuffer, FFTLEN);                /// Get audio
-    FindFrequencyContent(spectrum, workingBuffer, FFTLEN);              /// Spectral analysis
-    //dftmag(spectrum, workingBuffer, FFTLEN);
+/**
+----Frame scheduling----
+All visualizers analyse STFT frames: windowed, a hop apart and aligned to hop
+boundaries. A visualizer called before the next frame has completed returns without
+doing anything, leaving the last frame on screen.
+**/
+static STFT analysisFrames;
 
-    /// Initialize bargraph (histogram) to zeros
-    for(int i=0; i<numbars; i++)
-        bargraph[i]=0;
+/**
+----Band analysis----
+The scaled-spectrum visualizers only use the bins between minfreq and maxfreq, so they
+keep just those up to date with a sliding DFT instead of doing a full FFT every frame.
+**/
+static SlidingDFT bandDFT;
 
-    /// Now mapping spectrum to histogram
-    for(int i=Freq0idx; i<FreqLidx; i++)
-    {
-        int index = (int)mapLin2Log(Freq0idx, FreqLidx-Freq0idx, 0, numbars, i);
-        /// For semilog scaling:
-        /// The number of elements spectrum[i] that map to a certain bargraph[index] is
-        /// roughly proportional to i.
-        /// So, divide spectrum[i] by i before adding it to bargraph[index].
-        bargraph[index]+=spectrum[i]/i;
-    }
-    //std::cout<<"\n";
+/**
+Narrow bands are zoomed instead: shifted down to 0Hz, decimated and transformed with a
+much shorter FFT, at the same resolution.
+**/
+static ZoomFFT bandZoom;
 
-    /// Now filling in the x-axis gaps left by the mapping.
-    /// Using arithmetic mean for smoothing.
-    for(int i=1; i<numbars-1; i++)
-        if(bargraph[i]==0)
-            bargraph[i]=(bargraph[i-1]+bargraph[i+1])/2;
+/// Bins [Freq0idx, FreqLidx) of the frame ending at end, into spectrum[]. False if there isn't enough audio.
+static bool bandAnalysis(sample* spectrum, AudioQueue &MainAudioQueue, unsigned long long end, int fftlen,
+                         int Freq0idx, int FreqLidx)
+{
+    WindowType window = analysisFrames.window();
+    if(ZoomFFT::decimationFor(fftlen, Freq0idx, FreqLidx) > 1)
+        return bandZoom.update(spectrum, MainAudioQueue, end, fftlen, Freq0idx, FreqLidx, window);
+    return bandDFT.update(spectrum, MainAudioQueue, end, fftlen, Freq0idx, FreqLidx, window);
+}
 
-    /// If adaptive find max value in bargraph[] and update graphScale to fit data on screen.
-    if(adaptive)
-    {
-        int maxv = bargraph[0];
-        for(int i=0; i<numbars; i++)
-        {
-            if(bargraph[i]>maxv)
-                maxv=bargraph[i];
-        }
-        graphScale = 1/(float)maxv;
-    }
+/**
+----Constant-Q analysis----
+The log-frequency views (semilog, log-log and the spectral tuner) use a constant-Q
+transform instead whenever it needs fewer samples than the FFT: its bins are spaced
+like the log axis, and a shorter window reacts faster. Its kernels carry their own Hann
+windows, so the analysis window doesn't apply.
+Display frequencies go through freq2index() like everywhere else, so both analyses show
+the same frequency at the same place.
+Each view has its own transform, since views can span different bands.
+**/
+#define CQT_BINS_PER_OCTAVE 24          /// Most constant-Q bins per octave for the log views
 
-    /// Clear console, print graph
-    system("cls");
-    show_bargraph(bargraph, numbars, graphheight,
-                  1, graphScale*graphheight, ':');
+static ConstantQ* viewCQ[MAX_VIEWS];                                    /// Kernels for each view
 
+/// Frequency of the signal held in bin freq2index(freq)
+static double analysedFrequency(float freq, int fftlen)
+{
+    return freq2index(freq)*(double)RATE/fftlen;
 }
 
-void LinearVisualizer(int minfreq, int maxfreq,  AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
-                      bool adaptive, float graphScale)
+/// Whether a constant-Q transform from minfreq would need fewer than fftlen samples. It
+/// can't start at 0Hz.
+static bool constantQFits(float minfreq, int binsPerOctave, int fftlen)
 {
-    sample workingBuffer[FFTLEN];
-    sample spectrum[FFTLEN];
-
-    int numbars = consoleWidth;
-    int graphheight = consoleHeight;
-
-    int bargraph[1000];
-
-    int Freq0idx = freq2index(minfreq);
-    int FreqLidx = freq2index(maxfreq);
-
-    MainAudioQueue.peekFreshData(workingBuffer, FFTLEN);
-    FindFrequencyContent(spectrum, workingBuffer, FFTLEN);
-    //dftmag(spectrum, workingBuffer, FFTLEN);
-
-    int bucketwidth = FFTLEN/numbars;
-
-    for(int i=0; i<numbars; i++)
-        bargraph[i]=0;
-
-    for(int i=Freq0idx; i<FreqLidx; i++)
-    {
-        int index = (int)(numbars*(i-Freq0idx)/(FreqLidx-Freq0idx));    /// Linear mapping instead of logarithmic
-        /// For linear scaling:
-        /// The number of elements spectrum[i] that map to a certain bargraph[index] is
-        /// fixed, and equal to bucketwidth.
-        /// So, divide spectrum[i] by bucketwidth before adding it to bargraph[index].
-        bargraph[index]+=spectrum[i]/bucketwidth;
-    }
-    //std::cout<<"\n";
-
-    for(int i=1; i<numbars-1; i++)
-        if(bargraph[i]==0)
-            bargraph[i]=(bargraph[i-1]+bargraph[i+1])/2;
+    return minfreq > 0 && ConstantQ::lengthFor(analysedFrequency(minfreq, fftlen), binsPerOctave, fftlen) < fftlen;
+}
 
-    if(adaptive)
+/// Transforms the audio before end with view's constant-Q transform spanning minfreq to
+/// maxfreq, into output. False if the queue no longer holds the audio.
+static bool constantQAnalysis(int view, float minfreq, float maxfreq, int binsPerOctave, AudioQueue &MainAudioQueue,
+                              unsigned long long end, int fftlen, std::vector<float>& output)
+{
+    double f0 = analysedFrequency(minfreq, fftlen);
+    double f1 = analysedFrequency(maxfreq, fftlen);
+    ConstantQ*& cq = viewCQ[view];
+    if(cq == nullptr || !cq->matches(f0, f1, binsPerOctave, fftlen))  /// Kernels are only rebuilt when something changes
     {
-        int maxv = bargraph[0];
-        for(int i=0; i<numbars; i++)
-        {
-            if(bargraph[i]>maxv)
-                maxv=bargraph[i];
-        }
-        graphScale = 1/(float)maxv;
+        delete cq;
+        cq = new ConstantQ(f0, f1, binsPerOctave, fftlen);
     }
-
-    system("cls");
-    show_bargraph(bargraph, numbars, graphheight, 1, graphScale*graphheight, ':');
+    output.resize(cq->bins());
+    AudioView frame;                                                    /// Transformed in place, without copying
+    if(!MainAudioQueue.view(frame, end-cq->length(), cq->length()))
+        return false;
+    cq->transform(output.data(), frame);
+    return MainAudioQueue.stillThere(end-cq->length());
 }
 
-void LoglogVisualizer(int minfreq, int maxfreq,  AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
-                      bool adaptive, float graphScale)
+/// Constant-Q magnitude at a fractional bin position, in the units FindFrequencyContent()
+/// would give for a peak in fftlen samples.
+static float constantQAt(const std::vector<float>& cqOutput, float position, int fftlen)
 {
-    sample workingBuffer[FFTLEN];
-    sample spectrum[FFTLEN];
-
-    int numbars = consoleWidth;
-    int graphheight = consoleHeight;
+    int last = cqOutput.size()-1;
+    position = std::max(0.0f, std::min(position, (float)last));
+    int k = std::min((int)position, last-1);
+    float frac = position-k;
+    float value = last>0 ? (1-frac)*cqOutput[k] + frac*cqOutput[k+1] : cqOutput[0];
+    return value*fftlen*0.005;
+}
 
-    int bargraph[1000];
+/// Constant-Q bins per octave for a log view of numbars bars
+static int logBinsPerOctave(int numbars, float minfreq, float maxfreq)
+{
+    return std::max(1, std::min(CQT_BINS_PER_OCTAVE, (int)round(numbars/log2(maxfreq/minfreq))));
+}
 
-    int Freq0idx = freq2index(minfreq);
-    int FreqLidx = freq2index(maxfreq);
+/**
+----Tuner analysis----
+The tuners and the chord guesser only look at frequencies up to TUNER_MAX_FREQ. When
+those bins fit in the passband of a decimated signal, they analyse fftlen/D decimated
+samples instead of fftlen: same bins, a fraction of the work. The window still covers
+the same stretch of time, as it must for the same frequency resolution.
+
+Only the bins the views read are computed: the octave-wrapped ranges of the spectral
+tuner's bars, the musical range TUNER_MIN_FREQ to TUNER_MAX_FREQ for the auto tuner, and
+all bins up to TUNER_MAX_FREQ for the chord guesser's peakiness. FindBinContent() then
+uses Goertzel filters when there are few enough of them, and a full FFT otherwise.
+**/
+#define TUNER_MIN_FREQ 27.5             /// Lowest pitch the auto tuner looks for (A0, Hz)
+#define TUNER_MAX_FREQ 5000             /// Highest harmonic the tuners look at (Hz)
 
-    MainAudioQueue.peekFreshData(workingBuffer, FFTLEN);
-    FindFrequencyContent(spectrum, workingBuffer, FFTLEN);
-    //dftmag(spectrum, workingBuffer, FFTLEN);
+static Decimator tunerDecimator;
 
-    for(int i=0; i<numbars; i++)
-        bargraph[i]=0;
+/// Puts the windowed frame ending at end, decimated by D, in workingBuffer. False if
+/// there isn't enough audio.
+static bool tunerAudio(AudioQueue &MainAudioQueue, unsigned long long end, int fftlen, int D)
+{
+    if(D == 1)
+        return analysisFrames.frame(workingBuffer, MainAudioQueue, end, fftlen);
+    if(!tunerDecimator.update(workingBuffer, MainAudioQueue, end, D, fftlen/D))
+        return false;
+    applyWindow(workingBuffer, fftlen/D, analysisFrames.window());
+    return true;
+}
 
-    for(int i=Freq0idx; i<FreqLidx; i++)
-    {
-        int index = (int)mapLin2Log(Freq0idx, FreqLidx-Freq0idx, 0, numbars, i);
-        bargraph[index]+=spectrum[i]/i;
-    }
-    //std::cout<<"\n";
+/// Makes up for decimation and windowing in the magnitudes of tuner audio
+static float tunerScale(int D)
+{
+    return D/windowGain(analysisFrames.window());
+}
 
-    /// Arithmetic-mean smoothing doesn't work well for log-log scaling.
-    /// Gap filling is instead done by simply copying the bar on the right.
-    for(int i=numbars-2; i>0; i--)
-        if(bargraph[i]==0)
-            bargraph[i]=bargraph[i+1];
+/**
+----Analysis frames----
+Analysis is split from drawing. Everything the views on screen need from one STFT frame
+is worked out once, into an AnalysisFrame, and any number of views draw from it:
+    - the FFT spectrum over the union of the scaled-spectrum views' bands,
+    - the tuner spectrum (bins up to TUNER_MAX_FREQ), shared by the spectral tuner,
+      the auto tuner and the chord guesser,
+    - a constant-Q transform for each log view short enough to use one,
+    - the auto tuner's pitch and the chord guesser's chord.
+Only what the requested views use is computed. So the log-log spectrum, the tuner and
+the chord guesser on screen at once cost one spectrum each, not one per view.
+**/
+#define MAX_BARS 1000                   /// Most histogram bars (console columns)
 
-    /// Log-scaling data (log base 1.01)
-    for(int i=0; i<numbars; i++)
-        bargraph[i]=log(bargraph[i])/log(1.01);
+struct ViewRequest
+{
+    ViewType type;
+    int minfreq, maxfreq;                                               /// Scaled-spectrum views
+    int numbars;                                                        /// Histogram views
+    int maxNotes;                                                       /// Chord guesser
 
-    if(adaptive)
+    bool operator==(const ViewRequest& r) const
     {
-        int maxv = bargraph[0];
-        for(int i=0; i<numbars; i++)
-        {
-            if(bargraph[i]>maxv)
-                maxv=bargraph[i];
-        }
-        graphScale = 1/(float)maxv;
+        return type==r.type && minfreq==r.minfreq && maxfreq==r.maxfreq && numbars==r.numbars && maxNotes==r.maxNotes;
     }
+};
 
-    system("cls");
-    show_bargraph(bargraph, numbars, graphheight, 1, graphScale*graphheight, ':');
-}
-
-void SpectralTuner(AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight, bool adaptive,
-                   float graphScale)
+struct AnalysisRequest
 {
-    sample workingBuffer[FFTLEN];
-    sample spectrum[FFTLEN];
-
-    int numbars = consoleWidth;
-    int graphheight = consoleHeight-3;                                          /// Minus 3 to make room for pitch names display
-
-    int bargraph[1000];
-    float octave1index[1000];                                                   /// Will hold "fractional indices" in spectrum[] that map to each bar
-
-    char pitchnames[1000] = "AA#BCC#DD#EFF#GG#";                                /// Will be updated with appropriate spacing as per window size.
-
-    /// SETTING FIRST-OCTAVE INDICES
-    /// The entire x-axis of the histogram is to span one octave i.e. an interval of 2.
-    /// Therefore, each bar index increment corresponds to an interval of 2^(1/numbars).
-    /// The first frequency is A1 = 55Hz.
-    /// So the ith frequency is 55Hz*2^(i/numbars).
-    for(int i=0; i<numbars+1; i++)
-        octave1index[i] = freq2index(55.0*pow(2,(float)i/numbars));             /// "Fractional index" in spectrum[] corresponding to ith frequency.
-
-    /// UPDATING PITCH NAMES STRING
-    float bars_per_semitone = (float)(numbars)/(float)12;
-    int chnum = 0;
-    /// Adding pitch letter names
-    pitchnames[chnum++]='A';
-    while(chnum<round(bars_per_semitone*1.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='A';
-    pitchnames[chnum++]='#';
-    while(chnum<round(bars_per_semitone*2.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='B';
-    while(chnum<round(bars_per_semitone*3.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='C';
-    while(chnum<round(bars_per_semitone*4.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='C';
-    pitchnames[chnum++]='#';
-    while(chnum<round(bars_per_semitone*5.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='D';
-    while(chnum<round(bars_per_semitone*6.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='D';
-    pitchnames[chnum++]='#';
-    while(chnum<round(bars_per_semitone*7.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='E';
-    while(chnum<round(bars_per_semitone*8.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='F';
-    while(chnum<round(bars_per_semitone*9.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='F';
-    pitchnames[chnum++]='#';
-    while(chnum<round(bars_per_semitone*10.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='G';
-    while(chnum<round(bars_per_semitone*11.0)) pitchnames[chnum++]=' ';
-    pitchnames[chnum++]='G';
-    pitchnames[chnum++]='#';
-
-    int newlinechar_pos = chnum;                                                /// Storing index of end of first line (letter names)
-    pitchnames[chnum++]='\n';                                                   /// And going to next line (row of pipes and dots)
+    int numViews;
+    ViewRequest views[MAX_VIEWS];
 
-    /// Adding row of pipes and dots
-    for(int i=0; i<12; i++)
+    bool operator==(const AnalysisRequest& r) const
     {
-        pitchnames[chnum++]='|';
-        while((chnum-newlinechar_pos-1)<round(bars_per_semitone*(float)(i+1)))
-            pitchnames[chnum++]='.';
+        if(numViews != r.numViews)
+            return false;
+        for(int i=0; i<numViews; i++)
+            if(!(views[i] == r.views[i]))
+                return false;
+        return true;
     }
-    pitchnames[chnum++]='\n';
-    pitchnames[chnum++]='\0';                                                   /// Terminating String
-
-    /// FINISHED SETTING PITCH NAMES STRING
-
-    MainAudioQueue.peekFreshData(workingBuffer, FFTLEN);
-    FindFrequencyContent(spectrum, workingBuffer, FFTLEN);
-    //dftmag(spectrum, workingBuffer, FFTLEN);
-
-    for(int i=0; i<numbars; i++)
-        bargraph[i]=0;
+};
 
-    /// PREPARING TUNER HISTOGRAM
-    /// Iterating through log-scaled output indices and mapping them to linear input indices
-    /// (instead of the other way round).
-    /// So, an exponential mapping.
-    for(int i=0; i<numbars-1; i++)
+struct AnalysisFrame
+{
+    AnalysisRequest request;                                            /// What was analysed
+    unsigned long long end;                                             /// Queue position just past the analysed audio
+    int fftlen;
+    std::vector<sample> spectrum;                                       /// FFT magnitudes, DC to Nyquist
+    int spectrumFirst, spectrumLast;                                    /// Bins of spectrum[] that are up to date
+    std::vector<sample> tunerSpectrum;                                  /// Tuner magnitudes, only the bins the views read are up to date
+    int tunerBins;                                                      /// Bins up to TUNER_MAX_FREQ, 0 if no tuner spectrum
+    int tunerMaxBin;                                                    /// Highest bin free of decimation roll-off
+    std::vector<float> constantQ[MAX_VIEWS];                            /// Constant-Q magnitudes for each view, empty if none
+    int binsPerOctave[MAX_VIEWS];
+    float pitch;                                                        /// Auto tuner pitch (Hz), 0 if none found
+    char chord[100];                                                    /// Chord guesser display string, empty if nothing to show
+};
+
+static void spectralTunerBins(std::vector<char>& wanted, int view, int numbars, const AnalysisFrame& frame);
+
+static std::vector<char> tunerWanted;                                   /// Whether each tuner bin is read by a view
+static std::vector<int> tunerBinList;                                   /// The bins to compute, in increasing order
+
+/// The tuner bins the views of request read, from decimated audio if possible. pitch and
+/// chord are set if an auto tuner or chord guesser is among them.
+static bool tunerAnalysis(AudioQueue &MainAudioQueue, AnalysisFrame& frame, const AnalysisRequest& request,
+                          bool pitch, bool chord)
+{
+    int fftlen = frame.fftlen;
+    int num_bins = std::min((int)freq2index(TUNER_MAX_FREQ), fftlen/2);
+    int D = Decimator::factorFor(fftlen, num_bins);
+    int maxBin = D>1 ? DECIMATION_PASSBAND*(fftlen/D/2) : fftlen/2;
+    frame.tunerBins = num_bins;
+    frame.tunerMaxBin = maxBin;
+
+    tunerWanted.assign(fftlen/D/2+1, 0);
+    if(chord)
+        std::fill(tunerWanted.begin(), tunerWanted.begin()+num_bins, 1);
+    if(pitch)
+        std::fill(tunerWanted.begin()+std::min((int)freq2index(TUNER_MIN_FREQ), num_bins), tunerWanted.begin()+num_bins, 1);
+    for(int i=0; i<request.numViews; i++)
+        if(request.views[i].type == SPECTRAL_TUNER_VIEW && frame.constantQ[i].empty())
+            spectralTunerBins(tunerWanted, i, request.views[i].numbars, frame);
+    tunerBinList.clear();
+    for(int k=0; k<(int)tunerWanted.size(); k++)
+        if(tunerWanted[k])
+            tunerBinList.push_back(k);
+    int wanted = tunerBinList.size();
+
+    /// For few enough bins FindBinContent() skips the full FFT. A full FFT of undecimated
+    /// audio reads the queue in place instead of workingBuffer.
+    frame.tunerSpectrum.resize(fftlen/D/2+1);
+    if(D == 1 && !goertzelIsFaster(fftlen, wanted))
     {
-        float index = octave1index[i];                                          /// "Fractional index" in spectrum[] corresponding to ith frequency.
-        float nextindex = octave1index[i+1];                                    /// "Fractional index" corresponding to (i+1)th frequency.
-        /// OCTAVE WRAPPING
-        /// To the frequency coefficient for any frequency F will be added:
-        /// The frequency coefficients of all frequencies F*2^n for n=1..8
-        /// (i.e., 8 octaves of the same-letter pitch)
-        for(int j=0; j<8; j++)                                                  /// Iterating through 8 octaves
-        {
-            //std::cout<<"\ni "<<i<<", index "<<index<<", next index "<<nextindex;
-            /// Add everything in spectrum[] between current index and next index to current histogram bar.
-            for(int k=round(index); k<round(nextindex); k++)                    /// Fractional indices must be rounded for use
-                /// There are (nextindex-index) additions for a particular bar, so divide each addition by this.
-                bargraph[i]+=0.02*spectrum[k]/(nextindex-index);
-
-            /// Frequency doubles with octave increment, so index in linearly spaced data also doubles.
-            index*=2;
-            nextindex*=2;
-        }
+        if(!analysisFrames.spectrum(frame.tunerSpectrum.data(), MainAudioQueue, frame.end, fftlen, 0.005*tunerScale(D)))
+            return false;
     }
-    //std::cout<<"\n";
-
-    if(adaptive)
+    else
     {
-        int maxv = bargraph[0];
-        for(int i=0; i<numbars; i++)
-        {
-            if(bargraph[i]>maxv)
-                maxv=bargraph[i];
-        }
-        graphScale = 1/(float)maxv;
+        if(!tunerAudio(MainAudioQueue, frame.end, fftlen, D))
+            return false;
+        FindBinContent(frame.tunerSpectrum.data(), workingBuffer, fftlen/D, tunerBinList.data(), wanted,
+                       0.005*tunerScale(D));
     }
-
-    system("cls");
-    std::cout<<pitchnames;
-    show_bargraph(bargraph, numbars, graphheight, 1, graphScale*graphheight, '=');
+    return true;
 }
 
 /**
-------------------
-----Auto Tuner----
-------------------
-startAutoTuner() is a more traditional guitar tuner. It performs internal pitch
-detection and displays a stationary "needle" and moving note-name "dial". Tuning
-can be performed by aligning the note name to the needle.
-
-Pitch detection is performed by finding peaks in the fft and assuming that they
-are harmonics of an underlying fundamental. The approximate HCF of the frequencies
-therefore gives the pitch.
-
-span_semitones sets the span (and precision) of the dial display, i.e. how many
-pitch names are to be shown on screen at once.
+----Pitch detection----
+Pitch detection for the auto tuner is performed by finding peaks in the fft and
+assuming that they are harmonics of an underlying fundamental. The approximate HCF of
+the frequencies therefore gives the pitch.
 **/
-
-void AutoTuner(AudioQueue &MainAudioQueue, int consoleWidth, bool printNeedle, int span_semitones)
+static float findPitch(const AnalysisFrame& frame)
 {
-    sample workingBuffer[FFTLEN];
-    sample spectrum[FFTLEN];
-
-    char needle[1000];                                                  /// For tuner needle, e.g. "------------|------------"
-    char notenames[1000];                                               /// For note names, e.g.   " A    A#   B    C    C#  "
-
-    int window_width = consoleWidth;
-
-    /// Prepare and print needle if required (if window width hasn't changed, needle need not be reprinted)
-    if(printNeedle)
-    {
-        /**
-        Sample needle:
-
-        -----------------------------|-----------------------------
-                                     |
-
-        **/
-
-        /// Preparing needle
-        int chnum = 0;
-        /// Add dashes in first half of first line
-        while(chnum<window_width/2)
-            needle[chnum++] = '-';
-        /// Add pipe
-        needle[chnum++] = '|';
-        /// Add dashes in second half of first line
-        while(chnum<window_width)
-            needle[chnum++] = '-';
-        /// Go to second line
-        needle[chnum++] = '\n';
-        /// Add whitespaces in first half of second line
-        while(chnum<3*window_width/2+1)
-            needle[chnum++] = ' ';
-        /// Add pipe
-        needle[chnum++] = '|';
-        /// whitespaces in second half of second line
-        while(chnum<2*window_width+1)
-            needle[chnum++] = ' ';
-        /// Go to next line for printing notenames
-        needle[chnum++] = '\n';
-        /// Terminate string
-        needle[chnum++] = '\0';
-        /// Clear console, print needle
-        system("cls");
-        std::cout<<needle;
-    }
-
-    MainAudioQueue.peekFreshData(workingBuffer, FFTLEN);
-    FindFrequencyContent(spectrum, workingBuffer, FFTLEN, 0.00005);
+    /// The auto tuner has always looked at magnitudes 100 times smaller than the other
+    /// views, which leaves only the stronger peaks.
+    /// Bins below TUNER_MIN_FREQ aren't computed for it.
+    std::vector<sample> spectrum(frame.tunerBins);
+    for(int k=std::min((int)freq2index(TUNER_MIN_FREQ), frame.tunerBins); k<frame.tunerBins; k++)
+        spectrum[k] = frame.tunerSpectrum[k]/100;
 
     int num_spikes = 5;                                             /// Number of fft spikes to consider for pitch deduction
     int SpikeLocs[100];                                             /// Array to store indices in spectrum[] of fft spikes
     float SpikeFreqs[100];                                          /// Array to store frequencies corresponding to spikes
 
-    Find_n_Largest(SpikeLocs, spectrum, num_spikes, FFTLEN/2);      /// Find spikes
+    Find_n_Largest(SpikeLocs, spectrum.data(), num_spikes, frame.tunerBins);   /// Find spikes
 
     for(int i=0; i<num_spikes; i++)                                 /// Find spike frequencies (assumed to be harmonics)
         SpikeFreqs[i] = index2freq(SpikeLocs[i]);
 
-    float pitch = approx_hcf(SpikeFreqs, num_spikes, 5, 5);        /// Find pitch as approximate HCF of spike frequencies
-
-    if(pitch)                                                       /// If pitch found, update notenames and print
-    {
-        for(int i=0; i<window_width; i++)                           /// First initialize notenames to all whitespace
-            notenames[i] = ' ';
-
-        /// Find pitch number (1 = A, 2 = A# etc.) and how many cents sharp or flat (centsOff<0 means flat)
-        float centsOff;
-        int pitch_num = pitchNumber(pitch, &centsOff);
-
-        /// Find appropriate location for pitch letter name based on centsOff
-        /// (centsOff = 0 means "In Tune", location exactly in the  middle of the window)
-        int loc_pitch = window_width/2 - centsOff*window_width/(span_semitones*100);
-
-        /// Write letter name corresponding to current pitch to appropriate location
-        pitchName(notenames+loc_pitch, pitch_num);
-
-        /// Write letter names of as many lower pitches as will fit on screen
-        int loc_prev_pitch = loc_pitch - window_width/span_semitones;
-        for(int i=0; loc_prev_pitch>0; i++)
-        {
-            pitchName(notenames+loc_prev_pitch, (22-i+pitch_num)%12+1);
-            loc_prev_pitch -= window_width/span_semitones;
-        }
-
-        /// Write letter names of as many higher pitches as will fit on screen
-        int loc_next_pitch = loc_pitch + window_width/span_semitones;
-        for(int i=0; loc_next_pitch<window_width; i++)
-        {
-            pitchName(notenames+loc_next_pitch, (pitch_num+i)%12+1);
-            loc_next_pitch += window_width/span_semitones;
-        }
-
-        notenames[window_width] = '\0';                             /// Terminate string
-
-        std::cout<<'\r'<<notenames;                                 /// Print notenames
-    }
+    return approx_hcf(SpikeFreqs, num_spikes, 5, 5);                /// Find pitch as approximate HCF of spike frequencies
 }
 
-void ChordGuesser(AudioQueue &MainAudioQueue, int max_notes)
+/**
+----Chord guessing----
+Finds distinct pitches among the tuner spectrum peaks and attempts to come up with a
+chord name. Writes the display string, or an empty string if the spectrum isn't peaky
+enough for a chord to have been played.
+**/
+static void guessChord(AnalysisFrame& frame, int max_notes)
 {
     if(!chord_dictionary_initialized)
         initialize_chord_dictionary();
 
-    sample workingBuffer[FFTLEN];
-    sample spectrum[FFTLEN];
-
     const float quartertone = pow(2.0, 1.0/24.0);                       /// Interval of quarter-tone (used to check pitch distinctness)
 
     const int num_spikes = 10;                                          /// Number of fft spikes to consider
@@ -440,11 +306,12 @@ void ChordGuesser(AudioQueue &MainAudioQueue, int max_notes)
 
     notes_found = 0;                                                    /// Number of distinct pitches (spikes) found
 
-    MainAudioQueue.peekFreshData(workingBuffer, FFTLEN);
-    FindFrequencyContent(spectrum, workingBuffer, FFTLEN);
+    /// Like the auto tuner, only harmonics up to TUNER_MAX_FREQ are considered
+    const int num_bins = frame.tunerBins;
+    sample* spectrum = frame.tunerSpectrum.data();
 
     Find_n_Largest(SpikeLocs, spectrum,                                 /// Find spikes. Somehow works worse with clump rejection,
-                   num_spikes, FFTLEN/2, false);                        /// so using separate pitch distinctness check.
+                   num_spikes, num_bins, false);                        /// so using separate pitch distinctness check.
 
     for(int i=0; i<num_spikes; i++)                                     /// Find spike frequencies
         SpikeFreqs[i] = index2freq(SpikeLocs[i]);
@@ -525,26 +392,1015 @@ void ChordGuesser(AudioQueue &MainAudioQueue, int max_notes)
     displaystring[chnum++] = '\0';
 
     /// Ad-hoc measure of peakiness of spectrum: peakiness = max/mean
+    /// Only bins below TUNER_MAX_FREQ are looked at.
     double fft_max = spectrum[0];
-    double fft_mean = (double)spectrum[0]/(double)FFTLEN;
+    double fft_mean = (double)spectrum[0]/(double)num_bins;
     double fft_std_dev = 0;
-    for(int i=1; i<FFTLEN; i++)
+    for(int i=1; i<num_bins; i++)
     {
-        fft_mean += (double)spectrum[i]/(double)FFTLEN;
+        fft_mean += (double)spectrum[i]/(double)num_bins;
         if(spectrum[i]>fft_max)
             fft_max = spectrum[i];
     }
-    for(int i=1; i<FFTLEN; i++)
+    for(int i=1; i<num_bins; i++)
     {
         double diff = (spectrum[i] - fft_mean);
-        fft_std_dev += diff*diff/(double)FFTLEN;
+        fft_std_dev += diff*diff/(double)num_bins;
     }
     fft_std_dev = sqrt(fft_std_dev);
     double peakiness = fft_std_dev/fft_mean;
 
     /// Display pitches, only if spectrum was peaky (if peaky, chord has probably been played)
-    if(peakiness>12)
-        std::cout<<'\r'<<displaystring<<"                         ";
+    /// For a few peaks among many bins, peakiness grows with the square root of the number
+    /// of bins. The threshold of 12 was for all fftlen/2+1 bins.
+    if(peakiness>12*sqrt((double)num_bins/(frame.fftlen/2+1)))
+        strcpy(frame.chord, displaystring);
+    else
+        frame.chord[0] = '\0';
+}
+
+/// Widens the FFT band [Freq0idx, FreqLidx] to take in minfreq to maxfreq. Bins above
+/// Nyquist are not computed.
+static void widenBand(int& Freq0idx, int& FreqLidx, float minfreq, float maxfreq, int fftlen)
+{
+    Freq0idx = std::min(Freq0idx, (int)freq2index(minfreq));
+    FreqLidx = std::max(FreqLidx, std::min((int)freq2index(maxfreq), fftlen/2));
+}
+
+/// Analyses the next STFT frame for the requested views. False if there is none yet.
+static bool analyse(const AnalysisRequest& request, AudioQueue &MainAudioQueue, AnalysisFrame& frame)
+{
+    int fftlen = getFFTLength();                                        /// Number of samples to analyse
+    prepareBuffers(fftlen);
+
+    unsigned long long end = analysisFrames.next(MainAudioQueue, fftlen);  /// Queue position just past the frame to analyse
+    if(end == 0)
+        return false;                                                   /// No new frame since the last call
+    frame.end = end;
+    frame.fftlen = fftlen;
+    frame.spectrum.resize(fftlen/2+1);
+    frame.tunerBins = 0;
+
+    /// Constant-Q transforms where they are shorter; the band the rest need from the FFT
+    int Freq0idx = fftlen/2, FreqLidx = 0;
+    bool tuner = false, pitch = false, chord = false;
+    int maxNotes = 0;
+    for(int i=0; i<request.numViews; i++)
+    {
+        const ViewRequest& view = request.views[i];
+        frame.constantQ[i].clear();
+        switch(view.type)
+        {
+            case SEMILOG_VIEW:
+            case LOGLOG_VIEW:
+                frame.binsPerOctave[i] = logBinsPerOctave(view.numbars, view.minfreq, view.maxfreq);
+                if(constantQFits(view.minfreq, frame.binsPerOctave[i], fftlen))
+                {
+                    if(!constantQAnalysis(i, view.minfreq, view.maxfreq, frame.binsPerOctave[i], MainAudioQueue, end,
+                                          fftlen, frame.constantQ[i]))
+                        return false;
+                }
+                else                                                    /// From the FFT, like the other scales
+                    widenBand(Freq0idx, FreqLidx, view.minfreq, view.maxfreq, fftlen);
+                break;
+            case LINEAR_VIEW:
+            case MEL_VIEW:
+            case BARK_VIEW:
+            case ERB_VIEW:
+                widenBand(Freq0idx, FreqLidx, view.minfreq, view.maxfreq, fftlen);
+                break;
+            case SPECTRAL_TUNER_VIEW:
+                /// Its constant-Q bins are spaced evenly in pitch, binsPerOctave to an octave, from 55Hz
+                frame.binsPerOctave[i] = std::min(view.numbars, CQT_BINS_PER_OCTAVE);
+                if(constantQFits(55, frame.binsPerOctave[i], fftlen))
+                {
+                    if(!constantQAnalysis(i, 55, 55*256, frame.binsPerOctave[i], MainAudioQueue, end, fftlen,
+                                          frame.constantQ[i]))
+                        return false;
+                }
+                else
+                    tuner = true;
+                break;
+            case AUTO_TUNER_VIEW:
+                tuner = pitch = true;
+                break;
+            case CHORD_VIEW:
+                tuner = chord = true;
+                maxNotes = std::max(maxNotes, view.maxNotes);
+                break;
+        }
+    }
+
+    /// Spectral analysis of the freshest audio, only between the lowest minfreq and highest maxfreq
+    if(Freq0idx < FreqLidx && !bandAnalysis(frame.spectrum.data(), MainAudioQueue, end, fftlen, Freq0idx, FreqLidx))
+        return false;                                                   /// Not enough audio recorded yet
+    frame.spectrumFirst = Freq0idx;
+    frame.spectrumLast = FreqLidx;
+
+    if(tuner && !tunerAnalysis(MainAudioQueue, frame, request, pitch, chord))
+        return false;
+    if(pitch)
+        frame.pitch = findPitch(frame);
+    if(chord)
+        guessChord(frame, maxNotes);
+    return true;
+}
+
+/**
+----Analysis thread----
+Analysis runs on its own thread, for whatever the visualizer last called asked for (an
+AnalysisRequest), and publishes each AnalysisFrame through a TripleBuffer. The
+visualizer itself only draws the newest frame, if it is new and for the same request,
+so it never waits for analysis and a slow console write never delays the next analysis.
+Between frames the thread sleeps in AudioQueue::waitFor() until the next hop of audio
+has been pushed, and after publishing it wakes FrameScheduler::wait() through
+frameReady.
+
+All the analysis state above (buffers, sliding DFT, constant-Q kernels...) belongs to
+the analysis thread.
+**/
+static TripleBuffer<AnalysisFrame> analysisResults;
+static std::thread analysisThread;
+static std::atomic<bool> analysisRunning(false);
+static AudioQueue* analysedQueue = nullptr;
+static std::mutex requestLock;                                          /// Guards currentRequest
+static AnalysisRequest currentRequest;
+static std::mutex frameLock;                                            /// For frameReady
+static std::condition_variable frameReady;                              /// Notified when a frame is published
+
+#define ANALYSIS_WAIT_TIMEOUT 100       /// Longest wait for audio (ms), so that the thread notices it should stop
+
+static void analysisLoop()
+{
+    while(analysisRunning.load(std::memory_order_acquire))
+    {
+        AnalysisRequest request;
+        {
+            std::lock_guard<std::mutex> lock(requestLock);
+            request = currentRequest;
+        }
+        AnalysisFrame& frame = analysisResults.writeBuffer();
+        if(analyse(request, *analysedQueue, frame))
+        {
+            frame.request = request;
+            analysisResults.publish();
+            {
+                std::lock_guard<std::mutex> lock(frameLock);            /// So that a waiter can't miss it
+            }
+            frameReady.notify_all();
+        }
+        else                                                            /// Wait for the next hop of audio
+            analysedQueue->waitFor(analysisFrames.nextEnd(getFFTLength()), ANALYSIS_WAIT_TIMEOUT);
+    }
+}
+
+void StopAnalysisThread()
+{
+    if(!analysisThread.joinable())
+        return;
+    analysisRunning.store(false, std::memory_order_release);
+    analysisThread.join();
+}
 
+/// Asks for request to be analysed from now on (starting the thread if need be) and
+/// returns the newest frame for it, or nullptr if there is no new one yet.
+static const AnalysisFrame* latestFrame(AudioQueue &MainAudioQueue, const AnalysisRequest& request)
+{
+    if(analysedQueue != &MainAudioQueue)
+        StopAnalysisThread();
+    {
+        std::lock_guard<std::mutex> lock(requestLock);
+        currentRequest = request;
+    }
+    if(!analysisThread.joinable())
+    {
+        analysedQueue = &MainAudioQueue;
+        analysisRunning.store(true, std::memory_order_release);
+        analysisThread = std::thread(analysisLoop);
+    }
+    if(!analysisResults.update())
+        return nullptr;
+    const AnalysisFrame& frame = analysisResults.readBuffer();
+    if(!(frame.request == request))                                     /// Analysed for the previous views
+        return nullptr;
+    return &frame;
+}
+
+static size_t barMappingMemory();
+
+size_t VisualizerMemory()
+{
+    size_t total = bufferLength*sizeof(sample);
+    total += bandDFT.memoryUsage() + bandZoom.memoryUsage() + tunerDecimator.memoryUsage();
+    for(int i=0; i<MAX_VIEWS; i++)
+        if(viewCQ[i] != nullptr)
+            total += viewCQ[i]->memoryUsage();
+    for(int i=0; i<3; i++)                                              /// Spectra held by the analysis frames
+    {
+        const AnalysisFrame& frame = analysisResults.buffer(i);
+        total += (frame.spectrum.capacity() + frame.tunerSpectrum.capacity())*sizeof(sample);
+        for(int j=0; j<MAX_VIEWS; j++)
+            total += frame.constantQ[j].capacity()*sizeof(float);
+    }
+    return total + barMappingMemory();
+}
+
+/// The request for a single view
+static AnalysisRequest singleView(ViewType type, int minfreq, int maxfreq, int numbars, int maxNotes = 0)
+{
+    AnalysisRequest request;
+    request.numViews = 1;
+    request.views[0].type = type;
+    request.views[0].minfreq = minfreq;
+    request.views[0].maxfreq = maxfreq;
+    request.views[0].numbars = numbars;
+    request.views[0].maxNotes = maxNotes;
+    return request;
+}
+
+/**
+--------------------------------------
+----Visualizer Function Parameters----
+--------------------------------------
+minfreq and maxfreq are the horizontal (frequency) bounds of the spectral histogram.
+
+adaptive sets whether to continually adjust vertical scaling to fit and fill console
+window.
+
+iterations is the total number of refresh cycles before function return.
+
+delayMicroseconds sets the visualizer refresh rate or "frame rate".
+
+graphScale sets the vertical scale of data relative to the console window height.
+Irrelevant if adaptive is enabled.
+**/
+
+/// What the visualizers draw on. Only they and the main thread use it.
+static ConsoleScreen screen;
+
+void consoleWrite(const char* data, int n)
+{
+    DWORD written = 0;
+    WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), data, n, &written, NULL);
+}
+
+bool consoleEnableAnsi()
+{
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    return GetConsoleMode(console, &mode) && SetConsoleMode(console, mode|ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+}
+
+static bool codePageSaved = false;
+static UINT savedCodePage;                                              /// From before consoleUseUtf8(), 0 if unknown
+
+static void restoreCodePage()
+{
+    if(savedCodePage != 0)
+        SetConsoleOutputCP(savedCodePage);
+}
+
+void consoleUseUtf8()
+{
+    if(codePageSaved)
+        return;
+    codePageSaved = true;
+    savedCodePage = GetConsoleOutputCP();
+    SetConsoleOutputCP(CP_UTF8);
+    atexit(restoreCodePage);                                            /// However main() ends
+}
+
+ConsoleScreen& VisualizerScreen()
+{
+    return screen;
+}
+
+/// Scales bars to graphheight (to fill it, if adaptive) and prints them
+static void drawBars(const int* bargraph, int numbars, int graphheight, bool adaptive, float graphScale, char symbol)
+{
+    /// If adaptive find max value in bargraph[] and update graphScale to fit data on screen.
+    if(adaptive)
+    {
+        int maxv = bargraph[0];
+        for(int i=0; i<numbars; i++)
+        {
+            if(bargraph[i]>maxv)
+                maxv=bargraph[i];
+        }
+        graphScale = 1/(float)maxv;
+    }
+
+    show_bargraph(screen, bargraph, numbars, graphheight, 1, graphScale*graphheight, symbol);
+}
+
+/**
+----Bar mappings----
+Drawing a histogram gathers analysed magnitudes into bars. Which of them go into which
+bar, and with what weights, only depends on the view, its band, the console width and
+the analysis (FFT length, or constant-Q bins per octave), so it is worked out once into
+a BarMapping and reused until one of those changes. Bar b is the weighted sum of
+entries barStart[b] to barStart[b+1]-1,
+    FFT:        sum of spectrum[bin[e]]*weight[e]
+    constant-Q: sum of constantQAt(position[e])*weight[e]
+so a frame is drawn with a plain gather-accumulate loop, without a log() or a divide
+per bin. Each view of a split view has its own mapping.
+**/
+struct BarMapping
+{
+    ViewType type;                                                      /// What the mapping was built for
+    int minfreq, maxfreq, numbars, fftlen;
+    int binsPerOctave;                                                  /// Of the constant-Q transform, 0 for the FFT
+    int maxBin;                                                         /// Highest usable tuner spectrum bin (tuner, FFT only)
+    std::vector<int> barStart;                                          /// First entry of each bar, and one past the last
+    std::vector<int> bin;                                               /// FFT bin of each entry
+    std::vector<float> position;                                        /// Or fractional constant-Q bin
+    std::vector<float> weight;
+
+    bool matches(ViewType t, int f0, int f1, int bars, int n, int bpo, int top) const
+    {
+        return !barStart.empty() && type==t && minfreq==f0 && maxfreq==f1 && numbars==bars && fftlen==n
+               && binsPerOctave==bpo && maxBin==top;
+    }
+};
+
+static BarMapping barMappings[MAX_VIEWS];
+
+static size_t barMappingMemory()
+{
+    size_t total = 0;
+    for(int i=0; i<MAX_VIEWS; i++)
+    {
+        const BarMapping& m = barMappings[i];
+        total += (m.barStart.capacity() + m.bin.capacity())*sizeof(int);
+        total += (m.position.capacity() + m.weight.capacity())*sizeof(float);
+    }
+    return total;
+}
+
+/**
+----Filter bank----
+The scaled-spectrum views map FFT bins to bars through a bank of triangular filters,
+spaced evenly along the view's frequency scale: bar b peaks (b+0.5)/numbars of the way
+from minfreq to maxfreq on the scale, and falls to zero at the peaks of the bars either
+side. So between the first and last peaks each bin is shared out between the two bars
+around it, with weights adding up to 1, and the bars cover the band without gaps. Where
+bars are narrower than bins the triangles are widened to a bin either side of the peak,
+which interpolates between the nearest bins instead of leaving bars empty.
+Each weight is also divided by the number of bins a bar holds at that frequency, as the
+views always did: by the bin index on the log scale, by a constant on the linear scale.
+The perceptual scales are normalised to show the same level as the log scale over the
+same band.
+Only the nonzero weights are stored, so a frame costs one sparse matrix-vector product,
+proportional to the number of bins in the band rather than bins times bars.
+**/
+
+/// Position of frequency f (Hz) on the frequency scale of a view
+static double scaleOf(ViewType type, double f)
+{
+    switch(type)
+    {
+        case LINEAR_VIEW: return f;
+        case MEL_VIEW:    return 2595*log10(1+f/700);
+        case BARK_VIEW:   return 26.81*f/(1960+f)-0.53;                 /// Traunmuller's approximation
+        case ERB_VIEW:    return 21.4*log10(1+0.00437*f);               /// Glasberg and Moore's ERB-rate
+        default:          return log(f);
+    }
+}
+
+/// Inverse of scaleOf()
+static double frequencyAt(ViewType type, double u)
+{
+    switch(type)
+    {
+        case LINEAR_VIEW: return u;
+        case MEL_VIEW:    return 700*(pow(10, u/2595)-1);
+        case BARK_VIEW:   return 1960*(u+0.53)/(26.28-u);
+        case ERB_VIEW:    return (pow(10, u/21.4)-1)/0.00437;
+        default:          return exp(u);
+    }
+}
+
+/// Derivative of scaleOf() with respect to frequency
+static double scaleSlope(ViewType type, double f)
+{
+    switch(type)
+    {
+        case LINEAR_VIEW: return 1;
+        case MEL_VIEW:    return 2595/(log(10)*(700+f));
+        case BARK_VIEW:   return 26.81*1960/((1960+f)*(1960+f));
+        case ERB_VIEW:    return 21.4*0.00437/(log(10)*(1+0.00437*f));
+        default:          return 1/f;
+    }
+}
+
+/// Scaled-spectrum bars from FFT bins, through the filter bank
+static void filterBankMapping(BarMapping& m)
+{
+    bool logScale = m.type==SEMILOG_VIEW || m.type==LOGLOG_VIEW;
+    int Freq0idx = std::max((int)freq2index(m.minfreq), logScale ? 1 : 0);    /// Bin 0 has no place on a log scale
+    int FreqLidx = std::min((int)freq2index(m.maxfreq), m.fftlen/2);    /// One past the last bin used (at most Nyquist)
+    if(FreqLidx <= Freq0idx)
+        return;                                                         /// Empty band, empty bars
+
+    double binWidth = index2freq(1);                                    /// Hz
+    double bottom = scaleOf(m.type, Freq0idx*binWidth);
+    double top = scaleOf(m.type, FreqLidx*binWidth);
+    double step = (top-bottom)/m.numbars;                               /// Between bar peaks, on the scale
+    int bucketwidth = std::max(m.fftlen/m.numbars, 1);
+    double density = log((double)FreqLidx/std::max(Freq0idx, 1))/(top-bottom);
+    for(int b=0; b<m.numbars; b++)
+    {
+        /// "Fractional indices" in spectrum[] of the feet and peak of the triangle
+        double left = freq2index(frequencyAt(m.type, bottom+(b-0.5)*step));
+        double centre = freq2index(frequencyAt(m.type, bottom+(b+0.5)*step));
+        double right = freq2index(frequencyAt(m.type, bottom+(b+1.5)*step));
+        left = std::min(left, centre-1);
+        right = std::max(right, centre+1);
+        for(int k=std::max((int)ceil(left), Freq0idx); k<right && k<FreqLidx; k++)
+        {
+            double w = k<=centre ? (k-left)/(centre-left) : (right-k)/(right-centre);
+            if(w <= 0)
+                continue;
+            if(m.type == LINEAR_VIEW)
+                w /= bucketwidth;
+            else
+                w *= binWidth*scaleSlope(m.type, k*binWidth)*density;   /// 1/k on the log scale
+            m.bin.push_back(k);
+            m.weight.push_back(w);
+        }
+        m.barStart[b+1] = m.bin.size();
+    }
+}
+
+/// Semilog and log-log bars from a constant-Q transform, divided by bin index as in the FFT path
+static void logConstantQMapping(BarMapping& m)
+{
+    float octaves = log2((float)m.maxfreq/m.minfreq);
+    for(int i=0; i<m.numbars; i++)
+    {
+        float octave = octaves*(i+0.5)/m.numbars;                       /// Octaves above minfreq at the middle of bar i
+        m.position.push_back(m.binsPerOctave*octave);
+        m.weight.push_back(1/freq2index(m.minfreq*pow(2, octave)));
+        m.barStart[i+1] = m.position.size();
+    }
+}
+
+/// Octave-wrapped tuner bars from FFT bins
+static void tunerBinMapping(BarMapping& m)
+{
+    int numbars = m.numbars;
+    std::vector<float> octave1index(numbars+1);                         /// Will hold "fractional indices" in spectrum[] that map to each bar
+
+    /// SETTING FIRST-OCTAVE INDICES
+    /// The entire x-axis of the histogram is to span one octave i.e. an interval of 2.
+    /// Therefore, each bar index increment corresponds to an interval of 2^(1/numbars).
+    /// The first frequency is A1 = 55Hz.
+    /// So the ith frequency is 55Hz*2^(i/numbars).
+    for(int i=0; i<numbars+1; i++)
+        octave1index[i] = freq2index(55.0*pow(2,(float)i/numbars));     /// "Fractional index" in spectrum[] corresponding to ith frequency.
+
+    /// Only octaves entirely within the usable tuner bins are shown.
+    int num_octaves = 0;
+    while(num_octaves<8 && round(octave1index[numbars]*(1<<num_octaves))<=m.maxBin)
+        num_octaves++;
+
+    /// Iterating through log-scaled output indices and mapping them to linear input indices
+    /// (instead of the other way round).
+    /// So, an exponential mapping.
+    for(int i=0; i<numbars-1; i++)
+    {
+        float index = octave1index[i];                                  /// "Fractional index" in spectrum[] corresponding to ith frequency.
+        float nextindex = octave1index[i+1];                            /// "Fractional index" corresponding to (i+1)th frequency.
+        /// OCTAVE WRAPPING
+        /// To the frequency coefficient for any frequency F will be added:
+        /// The frequency coefficients of all frequencies F*2^n for n=1..8
+        /// (i.e., 8 octaves of the same-letter pitch)
+        for(int j=0; j<num_octaves; j++)                                /// Iterating through (up to) 8 octaves
+        {
+            /// Add everything in spectrum[] between current index and next index to current histogram bar.
+            /// There are (nextindex-index) additions for a particular bar, so divide each addition by this.
+            for(int k=round(index); k<round(nextindex); k++)            /// Fractional indices must be rounded for use
+            {
+                m.bin.push_back(k);
+                m.weight.push_back(0.02/(nextindex-index));
+            }
+
+            /// Frequency doubles with octave increment, so index in linearly spaced data also doubles.
+            index*=2;
+            nextindex*=2;
+        }
+        m.barStart[i+1] = m.bin.size();
+    }
+    m.barStart[numbars] = m.bin.size();                                 /// The last bar is left empty
+}
+
+/// Octave-wrapped tuner bars from a constant-Q transform. Its bins are spaced evenly in
+/// pitch already, binsPerOctave to an octave, starting at 55Hz.
+static void tunerConstantQMapping(BarMapping& m)
+{
+    for(int i=0; i<m.numbars-1; i++)
+    {
+        for(int j=0; j<8; j++)                                          /// Same octave wrapping as above
+        {
+            m.position.push_back(m.binsPerOctave*(j+(i+0.5)/m.numbars));
+            m.weight.push_back(0.02);
+        }
+        m.barStart[i+1] = m.position.size();
+    }
+    m.barStart[m.numbars] = m.position.size();
+}
+
+/// The mapping of view (frame.request.views[view]), rebuilt if anything it depends on has changed
+static const BarMapping& barMapping(int view, ViewType type, int minfreq, int maxfreq, int numbars,
+                                    const AnalysisFrame& frame)
+{
+    int binsPerOctave = frame.constantQ[view].empty() ? 0 : frame.binsPerOctave[view];
+    int maxBin = type==SPECTRAL_TUNER_VIEW && binsPerOctave==0 ? frame.tunerMaxBin : 0;
+    BarMapping& m = barMappings[view];
+    if(m.matches(type, minfreq, maxfreq, numbars, frame.fftlen, binsPerOctave, maxBin))
+        return m;
+
+    m.type = type;
+    m.minfreq = minfreq;
+    m.maxfreq = maxfreq;
+    m.numbars = numbars;
+    m.fftlen = frame.fftlen;
+    m.binsPerOctave = binsPerOctave;
+    m.maxBin = maxBin;
+    m.barStart.assign(numbars+1, 0);
+    m.bin.clear();
+    m.position.clear();
+    m.weight.clear();
+    if(type == SPECTRAL_TUNER_VIEW)
+        binsPerOctave ? tunerConstantQMapping(m) : tunerBinMapping(m);
+    else
+        binsPerOctave ? logConstantQMapping(m) : filterBankMapping(m);
+    return m;
+}
+
+/// Bars of view from frame, through its mapping
+static void gatherBars(int* bargraph, const BarMapping& m, const AnalysisFrame& frame, int view)
+{
+    const int* barStart = m.barStart.data();
+    const float* weight = m.weight.data();
+    if(m.binsPerOctave)
+    {
+        const std::vector<float>& cqOutput = frame.constantQ[view];
+        const float* position = m.position.data();
+        for(int b=0; b<m.numbars; b++)
+        {
+            float sum = 0;
+            for(int e=barStart[b]; e<barStart[b+1]; e++)
+                sum += constantQAt(cqOutput, position[e], m.fftlen)*weight[e];
+            bargraph[b] = sum;
+        }
+        return;
+    }
+
+    const sample* spectrum = m.type==SPECTRAL_TUNER_VIEW ? frame.tunerSpectrum.data() : frame.spectrum.data();
+    const int* bin = m.bin.data();
+    for(int b=0; b<m.numbars; b++)
+    {
+        float sum = 0;
+        for(int e=barStart[b]; e<barStart[b+1]; e++)
+            sum += spectrum[bin[e]]*weight[e];
+        bargraph[b] = sum;
+    }
+}
+
+/// Histogram of a scaled-spectrum view (frame.request.views[view]) with numbars bars
+static void spectrumBars(int* bargraph, ViewType type, int numbars, int minfreq, int maxfreq,
+                         const AnalysisFrame& frame, int view)
+{
+    gatherBars(bargraph, barMapping(view, type, minfreq, maxfreq, numbars, frame), frame, view);
+
+    if(type == LOGLOG_VIEW)
+    {
+        /// Log-scaling data (log base 1.01). Empty bars stay empty.
+        const float logScale = 1/log(1.01);
+        for(int i=0; i<numbars; i++)
+            bargraph[i]=log(std::max(bargraph[i], 1))*logScale;
+    }
+}
+
+/// A scaled-spectrum view on its own
+static bool scaledVisualizer(ViewType type, int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth,
+                             int consoleHeight, bool adaptive, float graphScale)
+{
+    int numbars = std::min(consoleWidth*barsPerColumn(), MAX_BARS);     /// Number of bars in the histogram. Will fill the console window width.
+    int graphheight = consoleHeight;                                    /// Height of histogram in lines. Will be set to console window height.
+
+    const AnalysisFrame* frame = latestFrame(MainAudioQueue, singleView(type, minfreq, maxfreq, numbars));
+    if(frame == nullptr)
+        return false;                                                   /// Nothing new to show
+
+    int bargraph[MAX_BARS];                                             /// The histogram
+    spectrumBars(bargraph, type, numbars, minfreq, maxfreq, *frame, 0);
+
+    /// Clear console, print graph
+    screen.clear();
+    drawBars(bargraph, numbars, graphheight, adaptive, graphScale, ':');
+    screen.present();
+    return true;
+}
+
+bool SemilogVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                        bool adaptive, float graphScale)
+{
+    return scaledVisualizer(SEMILOG_VIEW, minfreq, maxfreq, MainAudioQueue, consoleWidth, consoleHeight, adaptive,
+                            graphScale);
+}
+
+bool LinearVisualizer(int minfreq, int maxfreq,  AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                      bool adaptive, float graphScale)
+{
+    return scaledVisualizer(LINEAR_VIEW, minfreq, maxfreq, MainAudioQueue, consoleWidth, consoleHeight, adaptive,
+                            graphScale);
+}
+
+bool LoglogVisualizer(int minfreq, int maxfreq,  AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                      bool adaptive, float graphScale)
+{
+    return scaledVisualizer(LOGLOG_VIEW, minfreq, maxfreq, MainAudioQueue, consoleWidth, consoleHeight, adaptive,
+                            graphScale);
+}
+
+bool MelVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                   bool adaptive, float graphScale)
+{
+    return scaledVisualizer(MEL_VIEW, minfreq, maxfreq, MainAudioQueue, consoleWidth, consoleHeight, adaptive,
+                            graphScale);
+}
+
+bool BarkVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                    bool adaptive, float graphScale)
+{
+    return scaledVisualizer(BARK_VIEW, minfreq, maxfreq, MainAudioQueue, consoleWidth, consoleHeight, adaptive,
+                            graphScale);
+}
+
+bool ErbVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                   bool adaptive, float graphScale)
+{
+    return scaledVisualizer(ERB_VIEW, minfreq, maxfreq, MainAudioQueue, consoleWidth, consoleHeight, adaptive,
+                            graphScale);
+}
+
+/// Marks the tuner spectrum bins that the octave-wrapped bars of view read. Builds the
+/// mapping the view is then drawn with.
+static void spectralTunerBins(std::vector<char>& wanted, int view, int numbars, const AnalysisFrame& frame)
+{
+    const BarMapping& m = barMapping(view, SPECTRAL_TUNER_VIEW, 0, 0, numbars, frame);
+    for(int k : m.bin)
+        wanted[k] = 1;
+}
+
+/// Octave-wrapped histogram of view (frame.request.views[view]) with numbars bars
+static void tunerBars(int* bargraph, int numbars, const AnalysisFrame& frame, int view)
+{
+    gatherBars(bargraph, barMapping(view, SPECTRAL_TUNER_VIEW, 0, 0, numbars, frame), frame, view);
+}
+
+/// Pitch letter names and a row of pipes and dots under them, spaced for numbars bars.
+/// Only rebuilt when numbars changes.
+static const char* tunerPitchNames(int numbars)
+{
+    static char pitchnames[2*MAX_BARS+8] = "AA#BCC#DD#EFF#GG#";         /// Will be updated with appropriate spacing as per window size.
+    static int pitchnamesWidth = 0;
+    if(numbars == pitchnamesWidth)
+        return pitchnames;
+    pitchnamesWidth = numbars;
+
+    /// UPDATING PITCH NAMES STRING
+    float bars_per_semitone = (float)(numbars)/(float)12;
+    int chnum = 0;
+    /// Adding pitch letter names
+    pitchnames[chnum++]='A';
+    while(chnum<round(bars_per_semitone*1.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='A';
+    pitchnames[chnum++]='#';
+    while(chnum<round(bars_per_semitone*2.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='B';
+    while(chnum<round(bars_per_semitone*3.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='C';
+    while(chnum<round(bars_per_semitone*4.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='C';
+    pitchnames[chnum++]='#';
+    while(chnum<round(bars_per_semitone*5.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='D';
+    while(chnum<round(bars_per_semitone*6.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='D';
+    pitchnames[chnum++]='#';
+    while(chnum<round(bars_per_semitone*7.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='E';
+    while(chnum<round(bars_per_semitone*8.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='F';
+    while(chnum<round(bars_per_semitone*9.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='F';
+    pitchnames[chnum++]='#';
+    while(chnum<round(bars_per_semitone*10.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='G';
+    while(chnum<round(bars_per_semitone*11.0)) pitchnames[chnum++]=' ';
+    pitchnames[chnum++]='G';
+    pitchnames[chnum++]='#';
+
+    int newlinechar_pos = chnum;                                                /// Storing index of end of first line (letter names)
+    pitchnames[chnum++]='\n';                                                   /// And going to next line (row of pipes and dots)
+
+    /// Adding row of pipes and dots
+    for(int i=0; i<12; i++)
+    {
+        pitchnames[chnum++]='|';
+        while((chnum-newlinechar_pos-1)<round(bars_per_semitone*(float)(i+1)))
+            pitchnames[chnum++]='.';
+    }
+    pitchnames[chnum++]='\n';
+    pitchnames[chnum++]='\0';                                                   /// Terminating String
+
+    /// FINISHED SETTING PITCH NAMES STRING
+    return pitchnames;
+}
+
+bool SpectralTuner(AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight, bool adaptive,
+                   float graphScale)
+{
+    int numbars = std::min(consoleWidth*barsPerColumn(), MAX_BARS);
+    int graphheight = consoleHeight-3;                                          /// Minus 3 to make room for pitch names display
+
+    const AnalysisFrame* frame = latestFrame(MainAudioQueue, singleView(SPECTRAL_TUNER_VIEW, 0, 0, numbars));
+    if(frame == nullptr)
+        return false;
+
+    int bargraph[MAX_BARS];
+    tunerBars(bargraph, numbars, *frame, 0);
+
+    screen.clear();
+    screen.print(tunerPitchNames(consoleWidth));
+    drawBars(bargraph, numbars, graphheight, adaptive, graphScale, '=');
+    screen.present();
+    return true;
+}
+
+/**
+------------------
+----Auto Tuner----
+------------------
+startAutoTuner() is a more traditional guitar tuner. It performs internal pitch
+detection and displays a stationary "needle" and moving note-name "dial". Tuning
+can be performed by aligning the note name to the needle.
+
+Pitch detection is performed by finding peaks in the fft and assuming that they
+are harmonics of an underlying fundamental. The approximate HCF of the frequencies
+therefore gives the pitch.
+
+span_semitones sets the span (and precision) of the dial display, i.e. how many
+pitch names are to be shown on screen at once.
+**/
+
+/// The two lines of the needle for a window window_width wide. Only rebuilt when the
+/// width changes.
+static const char* autoTunerNeedle(int window_width)
+{
+    static char needle[2*MAX_BARS+4];                                   /// For tuner needle, e.g. "------------|------------"
+    static int needleWidth = 0;
+    if(window_width == needleWidth)
+        return needle;
+    needleWidth = window_width;
+
+    /**
+    Sample needle:
+
+    -----------------------------|-----------------------------
+                                 |
+
+    **/
+
+    /// Preparing needle
+    int chnum = 0;
+    /// Add dashes in first half of first line
+    while(chnum<window_width/2)
+        needle[chnum++] = '-';
+    /// Add pipe
+    needle[chnum++] = '|';
+    /// Add dashes in second half of first line
+    while(chnum<window_width)
+        needle[chnum++] = '-';
+    /// Go to second line
+    needle[chnum++] = '\n';
+    /// Add whitespaces in first half of second line
+    while(chnum<3*window_width/2+1)
+        needle[chnum++] = ' ';
+    /// Add pipe
+    needle[chnum++] = '|';
+    /// whitespaces in second half of second line
+    while(chnum<2*window_width+1)
+        needle[chnum++] = ' ';
+    /// Go to next line for printing notenames
+    needle[chnum++] = '\n';
+    /// Terminate string
+    needle[chnum++] = '\0';
+    return needle;
+}
+
+/// Writes the note-name dial for pitch (which must be non-zero)
+static void autoTunerDial(char* notenames, float pitch, int window_width, int span_semitones)
+{
+    for(int i=0; i<window_width; i++)                           /// First initialize notenames to all whitespace
+        notenames[i] = ' ';
+
+    /// Find pitch number (1 = A, 2 = A# etc.) and how many cents sharp or flat (centsOff<0 means flat)
+    float centsOff;
+    int pitch_num = pitchNumber(pitch, &centsOff);
+
+    /// Find appropriate location for pitch letter name based on centsOff
+    /// (centsOff = 0 means "In Tune", location exactly in the  middle of the window)
+    int loc_pitch = window_width/2 - centsOff*window_width/(span_semitones*100);
+
+    /// Write letter name corresponding to current pitch to appropriate location
+    pitchName(notenames+loc_pitch, pitch_num);
+
+    /// Write letter names of as many lower pitches as will fit on screen
+    int loc_prev_pitch = loc_pitch - window_width/span_semitones;
+    for(int i=0; loc_prev_pitch>0; i++)
+    {
+        pitchName(notenames+loc_prev_pitch, (22-i+pitch_num)%12+1);
+        loc_prev_pitch -= window_width/span_semitones;
+    }
+
+    /// Write letter names of as many higher pitches as will fit on screen
+    int loc_next_pitch = loc_pitch + window_width/span_semitones;
+    for(int i=0; loc_next_pitch<window_width; i++)
+    {
+        pitchName(notenames+loc_next_pitch, (pitch_num+i)%12+1);
+        loc_next_pitch += window_width/span_semitones;
+    }
+
+    notenames[window_width] = '\0';                             /// Terminate string
+}
+
+bool AutoTuner(AudioQueue &MainAudioQueue, int consoleWidth, bool printNeedle, int span_semitones)
+{
+    char notenames[1000];                                               /// For note names, e.g.   " A    A#   B    C    C#  "
+
+    int window_width = consoleWidth;
+
+    /// Prepare and print needle if required (if window width hasn't changed, needle need not be reprinted)
+    if(printNeedle)
+    {
+        /// Clear console, print needle
+        screen.clear();
+        screen.print(autoTunerNeedle(window_width));
+    }
+
+    const AnalysisFrame* frame = latestFrame(MainAudioQueue, singleView(AUTO_TUNER_VIEW, 0, 0, 0));
+    if(frame != nullptr && frame->pitch)                                /// If pitch found, update notenames and print
+    {
+        autoTunerDial(notenames, frame->pitch, window_width, span_semitones);
+        screen.print('\r');
+        screen.print(notenames);                                        /// Print notenames
+    }
+    if(printNeedle || frame != nullptr)
+        screen.present();
+    return frame != nullptr;
+}
+
+bool ChordGuesser(AudioQueue &MainAudioQueue, int max_notes)
+{
+    const AnalysisFrame* frame = latestFrame(MainAudioQueue, singleView(CHORD_VIEW, 0, 0, 0, max_notes));
+    if(frame == nullptr)
+        return false;
+    if(frame->chord[0] != '\0')
+    {
+        screen.print('\r');
+        screen.print(frame->chord);
+        screen.print("                         ");
+        screen.present();
+    }
+    return true;
+}
+
+/**
+----Split view----
+All the views share one AnalysisFrame. The auto tuner takes 3 lines and the chord
+guesser 1; the histograms share the rest of the console equally, each with a line to
+spare for its bottom edge.
+**/
+bool SplitVisualizer(const View* views, int numViews, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight)
+{
+    numViews = std::min(numViews, MAX_VIEWS);
+    int numbars = std::min(consoleWidth*barsPerColumn(), MAX_BARS);
+
+    AnalysisRequest request;
+    request.numViews = numViews;
+    int fixedLines = 0, graphs = 0;
+    for(int i=0; i<numViews; i++)
+    {
+        ViewRequest& view = request.views[i];
+        view.type = views[i].type;
+        view.minfreq = views[i].minfreq;
+        view.maxfreq = views[i].maxfreq;
+        view.numbars = numbars;
+        view.maxNotes = CHORD_MAX_NOTES;
+        if(view.type == AUTO_TUNER_VIEW)
+            fixedLines += 3;
+        else if(view.type == CHORD_VIEW)
+            fixedLines += 1;
+        else
+            graphs++;
+    }
+    int paneHeight = graphs ? (consoleHeight-fixedLines)/graphs : 0;
+
+    const AnalysisFrame* frame = latestFrame(MainAudioQueue, request);
+    if(frame == nullptr)
+        return false;
+
+    screen.clear();
+    int bargraph[MAX_BARS];
+    char text[1000];
+    for(int i=0; i<numViews; i++)
+    {
+        const View& view = views[i];
+        switch(view.type)
+        {
+            case SEMILOG_VIEW:
+            case LINEAR_VIEW:
+            case LOGLOG_VIEW:
+            case MEL_VIEW:
+            case BARK_VIEW:
+            case ERB_VIEW:
+                spectrumBars(bargraph, view.type, numbars, view.minfreq, view.maxfreq, *frame, i);
+                drawBars(bargraph, numbars, paneHeight-2, view.adaptive, 0.0008, ':');
+                break;
+            case SPECTRAL_TUNER_VIEW:
+                tunerBars(bargraph, numbars, *frame, i);
+                screen.print(tunerPitchNames(consoleWidth));
+                drawBars(bargraph, numbars, paneHeight-4, view.adaptive, 0.0008, '=');
+                break;
+            case AUTO_TUNER_VIEW:
+                screen.print(autoTunerNeedle(consoleWidth));
+                if(frame->pitch)
+                {
+                    autoTunerDial(text, frame->pitch, consoleWidth, 4);
+                    screen.print(text);
+                }
+                break;
+            case CHORD_VIEW:
+                screen.print(frame->chord);
+                break;
+        }
+        if(i < numViews-1)
+            screen.print('\n');
+    }
+    screen.present();
+    return true;
+}
+
+/**
+----Frame scheduler----
+wait() checks the TripleBuffer itself, under frameLock, so it can't miss a frame
+published between the check and the wait.
+**/
+FrameScheduler::FrameScheduler(int periodMs)
+{
+    period = std::chrono::milliseconds(periodMs);
+    started = frameStart = nextStart = Clock::now();
+    drawnCount = missedCount = 0;
+    totalFrameTime = worstTime = 0;
+}
+
+void FrameScheduler::wait()
+{
+    std::this_thread::sleep_until(nextStart);                           /// Never more than one frame a period
+    {
+        std::unique_lock<std::mutex> lock(frameLock);
+        frameReady.wait_for(lock, period, []{ return analysisResults.fresh(); });
+    }
+    frameStart = Clock::now();
+}
+
+void FrameScheduler::frameDone(bool drawn)
+{
+    Clock::time_point now = Clock::now();
+    if(!drawn)                                                          /// Nothing new, try again straight away
+    {
+        nextStart = now;
+        return;
+    }
+    double frameTime = std::chrono::duration<double, std::milli>(now-frameStart).count();
+    drawnCount++;
+    totalFrameTime += frameTime;
+    worstTime = std::max(worstTime, frameTime);
+    nextStart = frameStart+period;
+    if(now > nextStart)                                                 /// Missed: carry on from the newest frame
+    {
+        missedCount++;
+        nextStart = now;
+    }
+}
+
+double FrameScheduler::fps() const
+{
+    double seconds = std::chrono::duration<double>(Clock::now()-started).count();
+    return seconds>0 ? drawnCount/seconds : 0;
 }
 
@@ -22,18 +22,38 @@ delayMicroseconds sets the visualizer refresh rate or "frame rate".
 
 graphScale sets the vertical scale of data relative to the console window height.
 Irrelevant if adaptive is enabled.
+
+Each visualizer returns true if it drew a new frame, false if there was none to draw.
 **/
 
-void SemilogVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+bool SemilogVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
                        bool adaptive = false, float graphScale = 0.0008);
 
-void LinearVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+bool LinearVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
                        bool adaptive = false, float graphScale = 0.0008);
 
-void LoglogVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+bool LoglogVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
                        bool adaptive = false, float graphScale = 0.0008);
 
-void SpectralTuner(AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight, bool adaptive = false,
+/**
+----Perceptual scales----
+MelVisualizer(), BarkVisualizer() and ErbVisualizer() are histograms like the semilog
+one, but with the bars spread along a perceptual frequency scale instead of a logarithmic
+one: mel, bark (critical bands) or ERB-rate (equivalent rectangular bandwidths). All three
+are nearly linear below a few hundred Hz and nearly logarithmic above, as the pitch
+resolution of hearing is, so the bass gets fewer bars than in the semilog view.
+**/
+
+bool MelVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                   bool adaptive = false, float graphScale = 0.0008);
+
+bool BarkVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                    bool adaptive = false, float graphScale = 0.0008);
+
+bool ErbVisualizer(int minfreq, int maxfreq, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight,
+                   bool adaptive = false, float graphScale = 0.0008);
+
+bool SpectralTuner(AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight, bool adaptive = false,
                    float graphScale = 0.0008);
 
 /**
@@ -52,11 +72,106 @@ span_semitones sets the span (and precision) of the dial display, i.e. how many
 pitch names are to be shown on screen at once.
 **/
 
-void AutoTuner(AudioQueue &MainAudioQueue, int consoleWidth, bool printNeedle = true, int span_semitones = 4);
+bool AutoTuner(AudioQueue &MainAudioQueue, int consoleWidth, bool printNeedle = true, int span_semitones = 4);
 
 /**
 ----Chord Guesser----
 ChordGuesser() finds frequency peaks and attempts to come up with a chord name.
 **/
 
-void ChordGuesser(AudioQueue &MainAudioQueue, int max_notes = 4);
+bool ChordGuesser(AudioQueue &MainAudioQueue, int max_notes = 4);
+
+/**
+----Split view----
+SplitVisualizer() shows up to MAX_VIEWS views at once, stacked down the console. They
+all draw from the same analysis of each frame, so a spectrum, a tuner and the chord
+guesser together cost little more than any one of them: the tuner views share one
+spectrum, and the scaled-spectrum views one band analysis covering all their bands.
+
+minfreq and maxfreq only apply to the scaled-spectrum views, adaptive only to the
+histograms. The auto tuner takes 3 lines and the chord guesser 1; the histograms share
+the rest.
+**/
+#define MAX_VIEWS 4                     /// Most views in a split view
+
+enum ViewType { SEMILOG_VIEW, LINEAR_VIEW, LOGLOG_VIEW, MEL_VIEW, BARK_VIEW, ERB_VIEW, SPECTRAL_TUNER_VIEW,
+                AUTO_TUNER_VIEW, CHORD_VIEW };
+
+struct View
+{
+    ViewType type;
+    int minfreq, maxfreq;
+    bool adaptive;
+};
+
+bool SplitVisualizer(const View* views, int numViews, AudioQueue &MainAudioQueue, int consoleWidth, int consoleHeight);
+
+/**
+----Console output----
+The visualizers draw on VisualizerScreen() (see ConsoleScreen), which only sends the
+console what changed since the last frame. It should be resize()d with the console
+window, and reset() after anything else has been printed.
+**/
+ConsoleScreen& VisualizerScreen();
+
+/**
+----Analysis thread----
+The visualizers above only draw. Their analysis runs on a background thread, started
+by the first call, which always works on the newest audio for whatever the last call
+showed and hands each finished frame over through a TripleBuffer. A call draws the
+newest finished frame, or returns at once if there isn't a new one, so drawing and
+analysis never wait for each other.
+
+StopAnalysisThread() stops the thread. Call it before the AudioQueue goes away, and
+before VisualizerMemory().
+**/
+
+void StopAnalysisThread();
+
+/**
+----------------------------
+----class FrameScheduler----
+----------------------------
+Paces the refresh loop. wait() returns once the next frame may be drawn: no sooner than
+periodMs after the last frame started, and then as soon as the analysis thread has a
+new frame, or after another period without one (so the loop can still check the
+keyboard). It sleeps on a condition variable meanwhile instead of polling.
+
+Call frameDone() after drawing, with what the visualizer returned. Each frame drawn has
+a deadline one period after it started; a frame finished later than that is counted
+as missed, and the next one starts straight away from the newest analysis. Late
+frames are dropped, never queued up.
+
+fps() is the rate frames were actually drawn at since construction, and frame times
+(in milliseconds) are from wait() returning to frameDone().
+**/
+class FrameScheduler
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::duration period;
+    Clock::time_point started;
+    Clock::time_point frameStart;                                       /// When wait() last returned
+    Clock::time_point nextStart;                                        /// Earliest start of the next frame
+    unsigned long long drawnCount, missedCount;
+    double totalFrameTime, worstTime;
+
+  public:
+    FrameScheduler(int periodMs);
+    void wait();
+    void frameDone(bool drawn);
+    unsigned long long framesDrawn() const { return drawnCount; }
+    unsigned long long missedDeadlines() const { return missedCount; }
+    double fps() const;
+    double meanFrameTime() const { return drawnCount ? totalFrameTime/drawnCount : 0; }
+    double worstFrameTime() const { return worstTime; }
+};
+
+/**
+----Visualizer memory----
+VisualizerMemory() is the number of bytes the visualizers have allocated for analysis and
+drawing: audio buffer, analysed spectra, sliding DFT, zoom FFT, decimator and constant-Q
+state, and the bin-to-bar mappings.
+FFT plans and window tables are shared, and counted separately.
+**/
+
+size_t VisualizerMemory();